@@ -47,39 +47,25 @@ public:
 	bool hit(const ray &r, interval ray_t) const
 	{
 		const point3 &orig = r.origin();
-		const vec3 &dir = r.direction();
+		const vec3 &inv_dir = r.inv_direction();
 
 		for (int axis = 0; axis < 3; axis++)
 		{
+			// the direction's sign says which slab plane is entered first, so no swap is needed
 			const interval &ax = axis_interval(axis);
-			const double adinv = 1.0 / dir[axis];
-
-			auto t0 = (ax.min - orig[axis]) * adinv;
-			auto t1 = (ax.max - orig[axis]) * adinv;
-
-			if (t0 < t1)
-			{
-				if (t0 > ray_t.min)
-					ray_t.min = t0;
-				if (t1 < ray_t.max)
-					ray_t.max = t1;
-			}
-			else
-			{
-				if (t1 > ray_t.min)
-					ray_t.min = t1;
-				if (t0 < ray_t.max)
-					ray_t.max = t0;
-			}
-
-			if (ray_t.min >= ray_t.max)
-				return false;
+			auto t0 = ((r.sign(axis) ? ax.max : ax.min) - orig[axis]) * inv_dir[axis];
+			auto t1 = ((r.sign(axis) ? ax.min : ax.max) - orig[axis]) * inv_dir[axis];
+
+			// written so they compile to maxsd/minsd; a NaN from 0 * inf (ray lying in a slab
+			// plane) fails the comparison and leaves that side of the interval unchanged
+			ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+			ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
 		}
-		return true;
+		return ray_t.min < ray_t.max;
 	}
 
 	// return the index of the longest axis of the bounding box
-	int longest_axis()
+	int longest_axis() const
 	{
 		if (interval_x.size() > interval_y.size())
 		{
@@ -91,6 +77,21 @@ public:
 		}
 	}
 
+	double surface_area() const
+	{
+		auto x = interval_x.size();
+		auto y = interval_y.size();
+		auto z = interval_z.size();
+		return 2 * (x * y + y * z + z * x);
+	}
+
+	point3 centroid() const
+	{
+		return point3(0.5 * (interval_x.min + interval_x.max),
+					  0.5 * (interval_y.min + interval_y.max),
+					  0.5 * (interval_z.min + interval_z.max));
+	}
+
 	static const aabb empty, universe;
 
 private:
@@ -0,0 +1,165 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "rtweekend.h"
+
+// An affine map p -> L p + t, stored as the 3x4 matrix [L | t]: translations, rotations about
+// any axis, scalings and any composition of them.
+struct affine3
+{
+	double m[3][4];
+
+	static affine3 identity() { return scaling(vec3(1, 1, 1)); }
+
+	static affine3 translation(const vec3 &offset)
+	{
+		affine3 a = identity();
+		for (int i = 0; i < 3; i++)
+			a.m[i][3] = offset[i];
+		return a;
+	}
+
+	static affine3 scaling(const vec3 &factors)
+	{
+		affine3 a{};
+		for (int i = 0; i < 3; i++)
+			a.m[i][i] = factors[i];
+		return a;
+	}
+
+	// rotation by 'degrees' about 'axis', counterclockwise looking down the axis
+	static affine3 rotation(const vec3 &axis, double degrees)
+	{
+		vec3 k = unit_vector(axis);
+		double radians = degrees_to_radians(degrees);
+		double c = cos(radians), s = sin(radians), C = 1 - c;
+		affine3 a{};
+		a.m[0][0] = c + k.x() * k.x() * C;
+		a.m[0][1] = k.x() * k.y() * C - k.z() * s;
+		a.m[0][2] = k.x() * k.z() * C + k.y() * s;
+		a.m[1][0] = k.y() * k.x() * C + k.z() * s;
+		a.m[1][1] = c + k.y() * k.y() * C;
+		a.m[1][2] = k.y() * k.z() * C - k.x() * s;
+		a.m[2][0] = k.z() * k.x() * C - k.y() * s;
+		a.m[2][1] = k.z() * k.y() * C + k.x() * s;
+		a.m[2][2] = c + k.z() * k.z() * C;
+		return a;
+	}
+
+	// rotation about the y axis with exactly the terms rotate_y uses
+	static affine3 rotation_y(double degrees)
+	{
+		double radians = degrees_to_radians(degrees);
+		double c = cos(radians), s = sin(radians);
+		affine3 a = identity();
+		a.m[0][0] = c;
+		a.m[0][2] = s;
+		a.m[2][0] = -s;
+		a.m[2][2] = c;
+		return a;
+	}
+
+	// the map applying 'first', then this one
+	affine3 operator*(const affine3 &first) const
+	{
+		affine3 a{};
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				double sum = j == 3 ? m[i][3] : 0;
+				for (int k = 0; k < 3; k++)
+					sum += m[i][k] * first.m[k][j];
+				a.m[i][j] = sum;
+			}
+		}
+		return a;
+	}
+
+	point3 point(const point3 &p) const
+	{
+		return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+					  m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+					  m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+	}
+
+	vec3 vector(const vec3 &v) const
+	{
+		return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+					m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+					m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+	}
+
+	// L^T v; called on the inverse map, this carries normals over, as L^-T n is normal to the
+	// mapped surface
+	vec3 transposed_vector(const vec3 &v) const
+	{
+		return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+					m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+					m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+	}
+
+	double determinant() const
+	{
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+			   m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+
+	// the inverse map; the map must not be singular
+	affine3 inverse() const
+	{
+		double inv_det = 1 / determinant();
+		affine3 a{};
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				// cofactor of m[j][i]
+				int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+				a.m[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) * inv_det;
+			}
+		}
+		vec3 t = a.vector(vec3(m[0][3], m[1][3], m[2][3]));
+		for (int i = 0; i < 3; i++)
+			a.m[i][3] = -t[i];
+		return a;
+	}
+
+	// Whether the map scales every direction by the same factor, as rotations, translations and
+	// uniform scalings do, and so keeps spheres spheres; 'scale' is then that factor.
+	bool is_similarity(double &scale) const
+	{
+		double squares[3][3];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				squares[i][j] = m[0][i] * m[0][j] + m[1][i] * m[1][j] + m[2][i] * m[2][j];
+		double s2 = squares[0][0];
+		const double tolerance = 1e-9 * s2;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				if (fabs(squares[i][j] - (i == j ? s2 : 0)) > tolerance)
+					return false;
+		scale = sqrt(s2);
+		return s2 > 0;
+	}
+
+	// the bounds of the mapped box, from each row's smallest and largest terms (Arvo's method)
+	aabb bounds(const aabb &box) const
+	{
+		point3 lo, hi;
+		for (int i = 0; i < 3; i++)
+		{
+			lo[i] = hi[i] = m[i][3];
+			for (int j = 0; j < 3; j++)
+			{
+				double a = m[i][j] * box.axis_interval(j).min;
+				double b = m[i][j] * box.axis_interval(j).max;
+				lo[i] += fmin(a, b);
+				hi[i] += fmax(a, b);
+			}
+		}
+		return aabb(lo, hi);
+	}
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef ALIGNED_ARRAY_H
+#define ALIGNED_ARRAY_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+constexpr size_t cache_line_size = 64;
+
+// frees what make_aligned_array allocated, with the aligned delete matching its aligned new
+struct aligned_delete
+{
+	void operator()(void *p) const { ::operator delete(p, std::align_val_t(cache_line_size)); }
+};
+
+template <typename T>
+using aligned_array = std::unique_ptr<T[], aligned_delete>;
+
+// 'count' uninitialized elements of a trivial type, starting on a cache line; throws bad_alloc
+// if there's no memory. Aligned operator new works with every compiler, which std::aligned_alloc
+// doesn't (MSVC lacks it).
+template <typename T>
+aligned_array<T> make_aligned_array(size_t count)
+{
+	static_assert(alignof(T) <= cache_line_size);
+	return aligned_array<T>(static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(cache_line_size))));
+}
+
+#endif
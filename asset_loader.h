@@ -0,0 +1,123 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs loading jobs, such as decoding textures, on a pool of background threads, so that they
+// overlap with each other and with whatever the submitting thread does next, typically building
+// geometry and BVHs. Threads start with the first job. Jobs start in the order they were
+// submitted.
+class asset_loader
+{
+public:
+	// 'threads' workers, 0 for one per hardware thread
+	explicit asset_loader(int threads = 0)
+		: thread_count(threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()))) {}
+
+	~asset_loader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+
+	asset_loader(const asset_loader &) = delete;
+	asset_loader &operator=(const asset_loader &) = delete;
+
+	void submit(std::function<void()> job)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (jobs.empty() && busy == 0)
+			first_submit = std::chrono::steady_clock::now();
+		jobs.push_back(std::move(job));
+		submitted++;
+		if (workers.empty())
+			for (int t = 0; t < thread_count; t++)
+				workers.emplace_back([this] { run(); });
+		wake.notify_one();
+	}
+
+	// block until every job submitted so far has finished; returns how long that took
+	double wait()
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return jobs.empty() && busy == 0; });
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	int threads() const { return thread_count; }
+
+	// jobs submitted so far, the time they took summed over threads, and the time from the first
+	// job of the last busy stretch being submitted to its last job finishing
+	int jobs_submitted() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return submitted;
+	}
+
+	double busy_seconds() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return work_seconds;
+	}
+
+	double wall_seconds() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return span_seconds;
+	}
+
+private:
+	const int thread_count;
+	mutable std::mutex mutex;
+	std::condition_variable wake, idle;
+	std::deque<std::function<void()>> jobs;
+	int busy = 0; // jobs running
+	bool stopping = false;
+	std::vector<std::thread> workers;
+	int submitted = 0;
+	double work_seconds = 0, span_seconds = 0;
+	std::chrono::steady_clock::time_point first_submit;
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+			std::function<void()> job = std::move(jobs.front());
+			jobs.pop_front();
+			busy++;
+
+			lock.unlock();
+			auto start = std::chrono::steady_clock::now();
+			job();
+			auto end = std::chrono::steady_clock::now();
+			lock.lock();
+
+			busy--;
+			work_seconds += std::chrono::duration<double>(end - start).count();
+			if (jobs.empty() && busy == 0)
+			{
+				span_seconds = std::chrono::duration<double>(end - first_submit).count();
+				idle.notify_all();
+			}
+		}
+	}
+};
+
+#endif
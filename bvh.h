@@ -3,84 +3,1136 @@
 
 #include "hittable_list.h"
 #include "rtweekend.h"
+#include "simd.h"
+#include "stats.h"
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <omp.h>
 
-class bvh_node : public hittable
+// one node of a flattened BVH, 32 bytes so two of them share a cache line.
+// nodes are stored in depth-first order: an interior node's first child directly follows it,
+// its second child lives at 'offset'. A leaf covers the primitive slots [offset, offset + count).
+struct linear_bvh_node
+{
+	float bounds_min[3];
+	float bounds_max[3];
+	uint32_t offset; // interior: index of the second child, leaf: first primitive slot
+	uint16_t count;	 // number of primitives in a leaf, 0 for interior nodes
+	uint8_t axis;	 // split axis of an interior node
+	uint8_t pad;
+
+	bool is_leaf() const { return count > 0; }
+
+	double surface_area() const
+	{
+		double x = double(bounds_max[0]) - bounds_min[0];
+		double y = double(bounds_max[1]) - bounds_min[1];
+		double z = double(bounds_max[2]) - bounds_min[2];
+		return 2 * (x * y + y * z + z * x);
+	}
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+enum class bvh_split
 {
+	median, // split at the object-count median along the longest axis
+	sah		// binned surface area heuristic
+};
+
+struct bvh_build_options
+{
+	bvh_split method = bvh_split::sah;
+	int max_leaf_size = 4;			// most primitives a leaf may hold (a node above this size is always split)
+	int sah_bins = 16;				// bins per axis, the candidate split planes are the bin boundaries
+	double traversal_cost = 1.0;	// SAH cost of visiting an interior node
+	double intersection_cost = 1.0; // SAH cost of intersecting one primitive
+	int threads = 0;				// build threads, 0 uses omp_get_max_threads(), 1 builds serially
+	int width = 2;					// children per node: 2, or 4/8 to collapse the tree into a wide BVH
+	bool simd = true;				// let a wide BVH test its boxes with SSE/AVX2 where the CPU has them
+};
+
+// The geometry-agnostic part of a BVH: the node array and the packed primitive index array.
+// It is built from one bounding box per primitive and knows nothing about what the primitives
+// are; traverse() calls back into the owner to intersect the primitives of the leaves it reaches.
+class linear_bvh
+{
+public:
+	std::vector<linear_bvh_node> nodes;
+	std::vector<uint32_t> indices; // primitive index of every slot, leaves reference contiguous slots
+	bvh_build_options options;	   // how the tree was built, also the cost model of sah_cost()
+	double build_seconds = 0;	   // wall time of the last build()
+	int build_threads = 1;		   // threads the last build() ran on
+
+	// Large inputs are built in parallel: the top levels are split one node at a time with the
+	// binning spread over all threads, and the subtrees below them are built concurrently, each
+	// into its own array, then spliced into depth-first order. The tree is the same for any
+	// thread count.
+	void build(const std::vector<aabb> &boxes, const bvh_build_options &build_options = bvh_build_options())
+	{
+		auto start = clock::now();
+
+		options = build_options;
+		options.max_leaf_size = std::max(1, std::min(options.max_leaf_size, 0xffff));
+		options.sah_bins = std::max(2, std::min(options.sah_bins, max_bins));
+
+		build_threads = options.threads > 0 ? options.threads : omp_get_max_threads();
+		if (boxes.size() < parallel_span)
+			build_threads = 1;
+
+		long long count = (long long)boxes.size();
+		indices.resize(boxes.size());
+		std::vector<point3> centroids(boxes.size());
+#pragma omp parallel for num_threads(build_threads) if (build_threads > 1)
+		for (long long i = 0; i < count; i++)
+		{
+			indices[i] = uint32_t(i);
+			centroids[i] = boxes[i].centroid();
+		}
+
+		nodes.clear();
+		if (!boxes.empty())
+		{
+			if (build_threads > 1)
+				build_parallel(boxes, centroids);
+			else
+			{
+				nodes.reserve(2 * boxes.size());
+				build_recursive(nodes, boxes, centroids, 0, boxes.size(), 0, 1);
+				nodes.shrink_to_fit();
+			}
+		}
+
+		build_seconds = std::chrono::duration<double>(clock::now() - start).count();
+	}
+
+	// Expected cost of tracing a random ray through the tree under the surface area heuristic:
+	// every node is weighted by the probability that a ray hitting the root also hits it.
+	// Lower is better; use it to compare trees built with different options.
+	double sah_cost() const
+	{
+		if (nodes.empty())
+			return 0;
+
+		double root_area = nodes[0].surface_area();
+		double cost = 0;
+		for (const auto &node : nodes)
+		{
+			double node_cost = node.is_leaf() ? options.intersection_cost * node.count : options.traversal_cost;
+			cost += node_cost * node.surface_area() / root_area;
+		}
+		return cost;
+	}
+
+	// depth of the deepest leaf
+	int depth() const
+	{
+		if (nodes.empty())
+			return 0;
+
+		// depth of every node, filled in as the depth-first order reaches it
+		std::vector<int> node_depth(nodes.size(), 1);
+		int deepest = 1;
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			deepest = std::max(deepest, node_depth[i]);
+			if (!nodes[i].is_leaf())
+			{
+				node_depth[i + 1] = node_depth[i] + 1;
+				node_depth[nodes[i].offset] = node_depth[i] + 1;
+			}
+		}
+		return deepest;
+	}
+
+	// bytes held by the node and index arrays
+	size_t memory_bytes() const
+	{
+		return nodes.capacity() * sizeof(linear_bvh_node) + indices.capacity() * sizeof(uint32_t);
+	}
+
+	// print the size, quality and build cost of the tree
+	void report(std::ostream &out) const
+	{
+		size_t leaves = 0, max_leaf = 0;
+		for (const auto &node : nodes)
+		{
+			if (node.is_leaf())
+			{
+				leaves++;
+				max_leaf = std::max(max_leaf, size_t(node.count));
+			}
+		}
+
+		out << "BVH (" << (options.method == bvh_split::sah ? "binned SAH" : "median split") << "): "
+			<< indices.size() << " primitives, " << nodes.size() << " nodes, " << leaves << " leaves, "
+			<< (leaves ? double(indices.size()) / leaves : 0.0) << " primitives per leaf (max " << max_leaf << "), "
+			<< "depth " << depth() << ", SAH cost " << sah_cost() << '\n'
+			<< "  built in " << build_seconds * 1000 << "ms on " << build_threads << " threads, "
+			<< memory_bytes() / 1024.0 << "KB\n";
+	}
+
+	// Walk the tree front to back with an explicit stack. hit_primitive(slot, ray_t) must
+	// intersect the primitive in 'slot' and, on a hit, shrink ray_t.max to the hit distance
+	// and return true. Since the interval shrinks with every hit and the child on the near side
+	// of the split plane is visited first, far subtrees are usually culled by their boxes.
+	template <typename F>
+	bool traverse(const ray &r, interval ray_t, F &&hit_primitive) const
+	{
+		return !nodes.empty() && traverse(nodes.data(), r, ray_t, hit_primitive);
+	}
+
+	// traverse() over a node array held elsewhere, such as a tree mapped from a file
+	template <typename F>
+	static bool traverse(const linear_bvh_node *nodes, const ray &r, interval ray_t, F &&hit_primitive)
+	{
+		uint32_t stack[64];
+		int stack_size = 0;
+		uint32_t current = 0;
+		bool hit_anything = false;
+		uint64_t node_tests = 0, primitive_tests = 0;
+
+		while (true)
+		{
+			const linear_bvh_node &node = nodes[current];
+			node_tests++;
+			if (hit_bounds(node, r, ray_t))
+			{
+				if (node.is_leaf())
+				{
+					primitive_tests += node.count;
+					for (uint32_t slot = node.offset; slot < node.offset + node.count; slot++)
+					{
+						if (hit_primitive(slot, ray_t))
+							hit_anything = true;
+					}
+				}
+				else if (r.sign(node.axis))
+				{
+					stack[stack_size++] = current + 1;
+					current = node.offset;
+					continue;
+				}
+				else
+				{
+					stack[stack_size++] = node.offset;
+					current = current + 1;
+					continue;
+				}
+			}
+
+			if (stack_size == 0)
+				break;
+			current = stack[--stack_size];
+		}
+
+		auto &stats = thread_stats();
+		stats.node_tests += node_tests;
+		stats.primitive_tests += primitive_tests;
+		return hit_anything;
+	}
+
+	// Walk the tree once for all 'active' lanes of a packet. Every node is tested against all
+	// lanes still in play, and a subtree is only entered by the lanes whose rays hit its box.
+	// hit_primitive(slot, mask) intersects the primitive in 'slot' for the lanes in 'mask',
+	// shrinking their t_max, and returns the lanes it hit. Children are ordered by the first
+	// active lane's direction, which for a coherent packet is the order of most of its rays.
+	template <typename F>
+	uint32_t traverse_packet(ray_packet &packet, uint32_t active, F &&hit_primitive) const
+	{
+		if (nodes.empty() || active == 0)
+			return 0;
+
+		struct entry
+		{
+			uint32_t node;
+			uint32_t mask;
+		};
+		entry stack[64];
+		int stack_size = 0;
+		entry current{0, active};
+		uint32_t hits = 0;
+		uint64_t node_tests = 0, primitive_tests = 0;
+
+		while (true)
+		{
+			const linear_bvh_node &node = nodes[current.node];
+			node_tests += lane_count(current.mask);
+			uint32_t mask = hit_bounds(node, packet, current.mask);
+			if (mask)
+			{
+				if (node.is_leaf())
+				{
+					primitive_tests += uint64_t(node.count) * lane_count(mask);
+					for (uint32_t slot = node.offset; slot < node.offset + node.count; slot++)
+						hits |= hit_primitive(slot, mask);
+				}
+				else
+				{
+					int lead = 0;
+					while (!(mask & (1u << lead)))
+						lead++;
+					uint32_t near = current.node + 1, far = node.offset;
+					if (packet.sign[node.axis][lead])
+						std::swap(near, far);
+					stack[stack_size++] = entry{far, mask};
+					current = entry{near, mask};
+					continue;
+				}
+			}
+
+			if (stack_size == 0)
+				break;
+			current = stack[--stack_size];
+		}
+
+		auto &stats = thread_stats();
+		stats.node_tests += node_tests;
+		stats.primitive_tests += primitive_tests;
+		return hits;
+	}
+
 private:
-	shared_ptr<hittable> left;
-	shared_ptr<hittable> right;
-	aabb bbox;
+	using clock = std::chrono::steady_clock;
+
+	// past this depth the SAH builder falls back to median splits, which keeps the tree
+	// shallow enough for the fixed-size traversal stack even on degenerate input
+	static constexpr int max_sah_depth = 32;
+	static constexpr int max_bins = 64;
+
+	// spans smaller than this are not worth spreading over several threads
+	static constexpr size_t parallel_span = 16384;
+
+	struct sah_bin
+	{
+		aabb bbox = aabb::empty;
+		size_t count = 0;
+	};
+
+	// bounds of a span's boxes and of their centroids, gathered before splitting it
+	struct span_bounds
+	{
+		aabb bbox = aabb::empty;
+		point3 cmin = point3(infinity, infinity, infinity);
+		point3 cmax = point3(-infinity, -infinity, -infinity);
+
+		void add(const aabb &box, const point3 &c)
+		{
+			bbox = aabb(bbox, box);
+			for (int a = 0; a < 3; a++)
+			{
+				cmin[a] = fmin(cmin[a], c[a]);
+				cmax[a] = fmax(cmax[a], c[a]);
+			}
+		}
 
-	static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index)
+		void merge(const span_bounds &other)
+		{
+			bbox = aabb(bbox, other.bbox);
+			for (int a = 0; a < 3; a++)
+			{
+				cmin[a] = fmin(cmin[a], other.cmin[a]);
+				cmax[a] = fmax(cmax[a], other.cmax[a]);
+			}
+		}
+	};
+
+	// a subtree below the top levels of a parallel build, built by one thread into its own
+	// array with node offsets relative to that array
+	struct subtree_task
 	{
-		auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-		auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-		return a_axis_interval.min < b_axis_interval.min;
+		size_t st, end;
+		int depth;
+		std::vector<linear_bvh_node> nodes;
+	};
+
+	// round outwards when narrowing the bounds to float so the node still encloses its primitives
+	static float round_down(double x)
+	{
+		float f = float(x);
+		return double(f) > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
 	}
 
-	static bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+	static float round_up(double x)
 	{
-		return box_compare(a, b, 0);
+		float f = float(x);
+		return double(f) < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
 	}
-	static bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+
+	static void set_bounds(linear_bvh_node &node, const aabb &bbox)
 	{
-		return box_compare(a, b, 1);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.bounds_min[axis] = round_down(bbox.axis_interval(axis).min);
+			node.bounds_max[axis] = round_up(bbox.axis_interval(axis).max);
+		}
 	}
-	static bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+
+	// Rounding in the slab test can shave a sliver off a box, and a ray through a corner the box
+	// shares with a primitive, such as a mesh vertex, would then miss it. The exit distance is
+	// pushed out by the test's worst-case rounding error (Ize, "Robust BVH Ray Traversal").
+	static constexpr double exit_scale = 1 + 6 * std::numeric_limits<double>::epsilon();
+
+	// the same branchless slab test as aabb::hit, on the float bounds
+	static bool hit_bounds(const linear_bvh_node &node, const ray &r, interval ray_t)
 	{
-		return box_compare(a, b, 2);
+		const point3 &orig = r.origin();
+		const vec3 &inv_dir = r.inv_direction();
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double t0 = ((r.sign(axis) ? node.bounds_max[axis] : node.bounds_min[axis]) - orig[axis]) * inv_dir[axis];
+			double t1 = ((r.sign(axis) ? node.bounds_min[axis] : node.bounds_max[axis]) - orig[axis]) * inv_dir[axis];
+			t1 *= exit_scale;
+			ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+			ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
+		}
+		return ray_t.min < ray_t.max;
 	}
 
-public:
-	bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {}
+	// the slab test above for every lane of a packet at once, returning the lanes in 'active' that hit
+	static uint32_t hit_bounds(const linear_bvh_node &node, const ray_packet &packet, uint32_t active)
+	{
+		double t_min[ray_packet::max_size], t_max[ray_packet::max_size];
+		double inside[ray_packet::max_size];
+		for (int k = 0; k < packet.size; k++)
+		{
+			t_min[k] = packet.t_min[k];
+			t_max[k] = packet.t_max[k];
+		}
+		for (int axis = 0; axis < 3; axis++)
+			clip_slab(node.bounds_min[axis], node.bounds_max[axis], packet.org[axis], packet.inv_dir[axis], t_min, t_max, packet.size);
+#pragma omp simd
+		for (int k = 0; k < packet.size; k++)
+			inside[k] = t_min[k] < t_max[k] ? 1.0 : 0.0;
+		return lane_mask(inside, packet.size) & active;
+	}
 
-	// recursively initialization
-	bvh_node(vector<shared_ptr<hittable>> &objects, size_t st, size_t end)
+	// narrow every lane's [t_min, t_max] to where its ray lies between the planes lo and hi of one axis.
+	// the near plane is picked from the sign of the inverse direction, so there is no branch to stop
+	// the loop from vectorizing
+	static void clip_slab(double lo, double hi, const double *org, const double *inv_dir,
+						  double *t_min, double *t_max, int count)
 	{
-		// build the bounding box of the span of objects
-		bbox = aabb::empty;
-		for (size_t object_idx = st; object_idx != end; object_idx++)
+#pragma omp simd
+		for (int k = 0; k < count; k++)
 		{
-			bbox = aabb(bbox, objects[object_idx]->bounding_box());
+			double t0 = (lo - org[k]) * inv_dir[k];
+			double t1 = (hi - org[k]) * inv_dir[k];
+			double t_near = inv_dir[k] < 0 ? t1 : t0;
+			double t_far = (inv_dir[k] < 0 ? t0 : t1) * exit_scale;
+			t_min[k] = t_near > t_min[k] ? t_near : t_min[k];
+			t_max[k] = t_far < t_max[k] ? t_far : t_max[k];
 		}
+	}
 
-		int axis = bbox.longest_axis();
-		auto comparator = (axis == 0)	? box_x_compare
-						  : (axis == 1) ? box_y_compare
-										: box_z_compare;
+	static int bin_index(double c, double cmin, double scale, int bins)
+	{
+		int b = int((c - cmin) * scale);
+		return b < bins ? b : bins - 1;
+	}
 
+	// split the top levels one node at a time, defer everything below to subtree tasks that
+	// run concurrently, then splice the pieces together in depth-first order
+	void build_parallel(const std::vector<aabb> &boxes, const std::vector<point3> &centroids)
+	{
+		size_t task_span = std::max(parallel_span / 4, boxes.size() / (8 * size_t(build_threads)));
+
+		std::vector<linear_bvh_node> top;
+		std::vector<int> top_task; // for every top node, the subtree task standing in for it or -1
+		std::vector<subtree_task> tasks;
+		build_top(top, top_task, tasks, boxes, centroids, 0, boxes.size(), 0, task_span);
+
+		// the biggest subtrees go first so the last ones to finish are small
+		std::vector<int> order(tasks.size());
+		for (size_t k = 0; k < tasks.size(); k++)
+			order[k] = int(k);
+		std::sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			return tasks[a].end - tasks[a].st > tasks[b].end - tasks[b].st;
+		});
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(build_threads)
+		for (int k = 0; k < int(order.size()); k++)
+		{
+			auto &task = tasks[order[k]];
+			task.nodes.reserve(2 * (task.end - task.st));
+			build_recursive(task.nodes, boxes, centroids, task.st, task.end, task.depth, 1);
+		}
+
+		size_t total = top.size();
+		for (const auto &task : tasks)
+			total += task.nodes.size() - 1;
+		nodes.reserve(total);
+		splice(top, top_task, tasks, 0);
+	}
+
+	// like build_recursive, but stops at spans of at most task_span and leaves a placeholder
+	// node for a subtree task there
+	uint32_t build_top(std::vector<linear_bvh_node> &top, std::vector<int> &top_task, std::vector<subtree_task> &tasks,
+					   const std::vector<aabb> &boxes, const std::vector<point3> &centroids,
+					   size_t st, size_t end, int depth, size_t task_span)
+	{
+		uint32_t index = uint32_t(top.size());
+		top.push_back(linear_bvh_node{});
+		top_task.push_back(-1);
+
+		if (end - st <= task_span)
+		{
+			top_task[index] = int(tasks.size());
+			tasks.push_back(subtree_task{st, end, depth, {}});
+			return index;
+		}
+
+		auto bounds = gather_bounds(boxes, centroids, st, end, build_threads);
+		set_bounds(top[index], bounds.bbox);
+
+		int axis;
+		size_t mid;
+		if (!choose_split(boxes, centroids, bounds, st, end, depth, build_threads, axis, mid))
+		{
+			top[index].offset = uint32_t(st);
+			top[index].count = uint16_t(end - st);
+			return index;
+		}
+
+		build_top(top, top_task, tasks, boxes, centroids, st, mid, depth + 1, task_span);
+		uint32_t second = build_top(top, top_task, tasks, boxes, centroids, mid, end, depth + 1, task_span);
+
+		top[index].offset = second;
+		top[index].count = 0;
+		top[index].axis = uint8_t(axis);
+		return index;
+	}
+
+	// append top node 'index' and everything below it to 'nodes' in depth-first order
+	void splice(const std::vector<linear_bvh_node> &top, const std::vector<int> &top_task,
+				std::vector<subtree_task> &tasks, uint32_t index)
+	{
+		if (top_task[index] >= 0)
+		{
+			auto &subtree = tasks[top_task[index]].nodes;
+			uint32_t base = uint32_t(nodes.size());
+			for (auto node : subtree)
+			{
+				if (!node.is_leaf())
+					node.offset += base;
+				nodes.push_back(node);
+			}
+			std::vector<linear_bvh_node>().swap(subtree);
+			return;
+		}
+
+		uint32_t at = uint32_t(nodes.size());
+		nodes.push_back(top[index]);
+		if (top[index].is_leaf())
+			return;
+
+		splice(top, top_task, tasks, index + 1);
+		nodes[at].offset = uint32_t(nodes.size());
+		splice(top, top_task, tasks, top[index].offset);
+	}
+
+	// append the subtree over slots [st, end) to 'out' in depth-first order, return its node index
+	uint32_t build_recursive(std::vector<linear_bvh_node> &out, const std::vector<aabb> &boxes,
+							 const std::vector<point3> &centroids, size_t st, size_t end, int depth, int threads)
+	{
+		uint32_t index = uint32_t(out.size());
+		out.push_back(linear_bvh_node{});
+
+		auto bounds = gather_bounds(boxes, centroids, st, end, threads);
+		set_bounds(out[index], bounds.bbox);
+
+		int axis;
+		size_t mid;
+		if (!choose_split(boxes, centroids, bounds, st, end, depth, threads, axis, mid))
+		{
+			out[index].offset = uint32_t(st);
+			out[index].count = uint16_t(end - st);
+			return index;
+		}
+
+		build_recursive(out, boxes, centroids, st, mid, depth + 1, threads);
+		uint32_t second = build_recursive(out, boxes, centroids, mid, end, depth + 1, threads);
+
+		out[index].offset = second;
+		out[index].count = 0;
+		out[index].axis = uint8_t(axis);
+		return index;
+	}
+
+	span_bounds gather_bounds(const std::vector<aabb> &boxes, const std::vector<point3> &centroids,
+							  size_t st, size_t end, int threads) const
+	{
+		span_bounds bounds;
+		if (threads > 1 && end - st >= parallel_span)
+		{
+#pragma omp parallel num_threads(threads)
+			{
+				span_bounds local;
+#pragma omp for nowait
+				for (long long slot = (long long)st; slot < (long long)end; slot++)
+					local.add(boxes[indices[slot]], centroids[indices[slot]]);
+#pragma omp critical(bvh_build_merge)
+				bounds.merge(local);
+			}
+		}
+		else
+		{
+			for (size_t slot = st; slot != end; slot++)
+				bounds.add(boxes[indices[slot]], centroids[indices[slot]]);
+		}
+		return bounds;
+	}
+
+	// pick the split of slots [st, end) and partition them around 'mid';
+	// return false if the span should become a leaf
+	bool choose_split(const std::vector<aabb> &boxes, const std::vector<point3> &centroids, const span_bounds &bounds,
+					  size_t st, size_t end, int depth, int threads, int &axis, size_t &mid)
+	{
+		if (options.method == bvh_split::sah && depth < max_sah_depth)
+			return split_sah(boxes, centroids, bounds, st, end, threads, axis, mid);
+		return split_median(boxes, bounds.bbox, st, end, axis, mid);
+	}
+
+	// sort the span by box minimum along the longest axis and cut it in half
+	bool split_median(const std::vector<aabb> &boxes, aabb bbox, size_t st, size_t end, int &axis, size_t &mid)
+	{
+		size_t object_span = end - st;
+		if (object_span <= size_t(options.max_leaf_size))
+			return false;
+
+		axis = bbox.longest_axis();
+		std::sort(indices.begin() + st, indices.begin() + end, [&](uint32_t a, uint32_t b)
+		{
+			return boxes[a].axis_interval(axis).min < boxes[b].axis_interval(axis).min;
+		});
+
+		mid = st + object_span / 2;
+		return true;
+	}
+
+	// Bin the centroids along each axis and pick the bin boundary with the lowest SAH cost.
+	// Return false if intersecting the span as one leaf is cheaper than any split.
+	bool split_sah(const std::vector<aabb> &boxes, const std::vector<point3> &centroids, const span_bounds &bounds,
+				   size_t st, size_t end, int threads, int &axis, size_t &mid)
+	{
+		const int bins = options.sah_bins;
 		size_t object_span = end - st;
 
-		if (object_span == 1)
-			left = right = objects[st];
-		else if (object_span == 2)
+		// the bins subdivide the bounds of the centroids, not of the boxes
+		double scale[3];
+		for (int a = 0; a < 3; a++)
 		{
-			left = objects[st];
-			right = objects[st + 1];
+			double extent = bounds.cmax[a] - bounds.cmin[a];
+			scale[a] = extent > 0 ? bins / extent : 0;
+		}
+
+		sah_bin bin[3][max_bins];
+		auto add_to_bins = [&](sah_bin(&b)[3][max_bins], size_t slot)
+		{
+			const aabb &box = boxes[indices[slot]];
+			const point3 &c = centroids[indices[slot]];
+			for (int a = 0; a < 3; a++)
+			{
+				auto &target = b[a][bin_index(c[a], bounds.cmin[a], scale[a], bins)];
+				target.bbox = aabb(target.bbox, box);
+				target.count++;
+			}
+		};
+
+		if (threads > 1 && object_span >= parallel_span)
+		{
+#pragma omp parallel num_threads(threads)
+			{
+				sah_bin local[3][max_bins];
+#pragma omp for nowait
+				for (long long slot = (long long)st; slot < (long long)end; slot++)
+					add_to_bins(local, size_t(slot));
+#pragma omp critical(bvh_build_merge)
+				for (int a = 0; a < 3; a++)
+				{
+					for (int i = 0; i < bins; i++)
+					{
+						bin[a][i].bbox = aabb(bin[a][i].bbox, local[a][i].bbox);
+						bin[a][i].count += local[a][i].count;
+					}
+				}
+			}
 		}
 		else
 		{
-			// Եǰbvhеprimitives
-			std::sort(objects.begin() + st, objects.begin() + end, comparator);
-			auto mid = st + object_span / 2;
-			left = make_shared<bvh_node>(objects, st, mid);
-			right = make_shared<bvh_node>(objects, mid, end);
+			for (size_t slot = st; slot != end; slot++)
+				add_to_bins(bin, slot);
+		}
+
+		double node_area = bounds.bbox.surface_area();
+		double best_cost = infinity;
+		int best_axis = -1;
+		int best_bin = 0;
+
+		for (int a = 0; a < 3; a++)
+		{
+			if (scale[a] == 0)
+				continue;
+
+			// sweep from the left for the bounds and count left of every boundary, then from the
+			// right, evaluating the split at each boundary on the way
+			double left_area[max_bins];
+			size_t left_count[max_bins];
+			aabb left = aabb::empty;
+			size_t left_n = 0;
+			for (int i = 0; i < bins - 1; i++)
+			{
+				left = aabb(left, bin[a][i].bbox);
+				left_n += bin[a][i].count;
+				left_area[i] = left_n ? left.surface_area() : 0;
+				left_count[i] = left_n;
+			}
+
+			aabb right = aabb::empty;
+			size_t right_n = 0;
+			for (int i = bins - 1; i > 0; i--)
+			{
+				right = aabb(right, bin[a][i].bbox);
+				right_n += bin[a][i].count;
+				if (left_count[i - 1] == 0 || right_n == 0)
+					continue;
+
+				double cost = options.traversal_cost +
+							  options.intersection_cost *
+								  (left_count[i - 1] * left_area[i - 1] + right_n * right.surface_area()) / node_area;
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = a;
+					best_bin = i - 1;
+				}
+			}
 		}
+
+		bool fits_leaf = object_span <= size_t(options.max_leaf_size);
+		if (best_axis < 0)
+		{
+			// every centroid is in the same spot, so no plane separates them; cut the span anywhere
+			if (fits_leaf)
+				return false;
+			axis = bounds.bbox.longest_axis();
+			mid = st + object_span / 2;
+			return true;
+		}
+
+		if (fits_leaf && options.intersection_cost * object_span <= best_cost)
+			return false;
+
+		axis = best_axis;
+		auto first_right = std::partition(indices.begin() + st, indices.begin() + end, [&](uint32_t i)
+		{
+			return bin_index(centroids[i][axis], bounds.cmin[axis], scale[axis], bins) <= best_bin;
+		});
+		mid = size_t(first_right - indices.begin());
+		return true;
 	}
+};
 
-	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+// Which box-test kernel a wide BVH uses; picked once when it is built.
+enum class bvh_kernel
+{
+	scalar,
+	sse,
+	avx2
+};
+
+inline const char *kernel_name(bvh_kernel kernel)
+{
+	switch (kernel)
+	{
+	case bvh_kernel::sse:
+		return "SSE";
+	case bvh_kernel::avx2:
+		return "AVX2";
+	default:
+		return "scalar";
+	}
+}
+
+// one node of a wide BVH: the boxes of up to W children in SoA layout, so all of them are tested
+// against a ray at once. Unused lanes have inverted (empty) boxes that no ray can enter.
+template <int W>
+struct alignas(32) wide_bvh_node
+{
+	float bounds[6][W]; // per lane: min x, y, z, then max x, y, z
+	uint32_t child[W];	// interior lane: index of the child node, leaf lane: first primitive slot
+	uint16_t count[W];	// primitives of a leaf lane, 0 for an interior or unused lane
+};
+
+// A 4- or 8-wide BVH made by collapsing a binary linear_bvh: every wide node adopts the
+// descendants of a binary node, opening the child with the largest surface area until it has
+// W of them. Leaves keep the binary tree's primitive slots, so its owner's primitive array is
+// shared between both trees.
+template <int W>
+class wide_bvh
+{
+public:
+	std::vector<wide_bvh_node<W>> nodes;
+	bvh_kernel kernel = bvh_kernel::scalar;
+
+	void build(const linear_bvh &tree, bool simd = true)
 	{
-		if (!bbox.hit(r, ray_t))
+		nodes.clear();
+		kernel = bvh_kernel::scalar;
+#ifdef SIMD_X86
+		if (simd && W == 4)
+			kernel = bvh_kernel::sse;
+		if (simd && W == 8 && cpu_has_avx2())
+			kernel = bvh_kernel::avx2;
+#endif
+		if (!tree.nodes.empty())
+			collapse(tree, 0);
+		nodes.shrink_to_fit();
+	}
+
+	size_t memory_bytes() const { return nodes.capacity() * sizeof(wide_bvh_node<W>); }
+
+	void report(std::ostream &out) const
+	{
+		out << "  collapsed to " << W << "-wide: " << nodes.size() << " nodes, "
+			<< memory_bytes() / 1024.0 << "KB, " << kernel_name(kernel) << " box tests\n";
+	}
+
+	// same contract as linear_bvh::traverse
+	template <typename F>
+	bool traverse(const ray &r, interval ray_t, F &&hit_primitive) const
+	{
+		if (nodes.empty())
 			return false;
 
-		bool hit_left = left->hit(r, ray_t, rec);
-		bool hit_right = right->hit(r, ray_t, rec);
+		lane_ray lr;
+		for (int a = 0; a < 3; a++)
+		{
+			lr.org[a] = float(r.origin()[a]);
+			lr.inv[a] = float(r.inv_direction()[a]);
+			lr.neg[a] = r.sign(a);
+		}
 
-		return hit_left || hit_right;
+		struct entry
+		{
+			uint32_t node;
+			float tnear;
+		};
+		entry stack[64 * (W - 1)];
+		int stack_size = 0;
+		uint32_t current = 0;
+		bool hit_anything = false;
+		uint64_t node_tests = 0, primitive_tests = 0;
+
+		while (true)
+		{
+			const wide_bvh_node<W> &node = nodes[current];
+			alignas(32) float tnear[W];
+			int mask = intersect(node, lr, ray_t, tnear);
+			node_tests += W;
+
+			// visit the lanes nearest first: leaves are intersected right away, interior
+			// children go on the stack far to near so the nearest is popped next
+			int order[W], hits = 0;
+			for (int k = 0; k < W; k++)
+			{
+				if (!(mask & (1 << k)))
+					continue;
+				int at = hits++;
+				while (at > 0 && tnear[order[at - 1]] > tnear[k])
+				{
+					order[at] = order[at - 1];
+					at--;
+				}
+				order[at] = k;
+			}
+
+			for (int h = 0; h < hits; h++)
+			{
+				int k = order[h];
+				if (node.count[k] == 0 || !(tnear[k] <= ray_t.max))
+					continue;
+				primitive_tests += node.count[k];
+				for (uint32_t slot = node.child[k]; slot < node.child[k] + node.count[k]; slot++)
+				{
+					if (hit_primitive(slot, ray_t))
+						hit_anything = true;
+				}
+			}
+			for (int h = hits - 1; h >= 0; h--)
+			{
+				int k = order[h];
+				if (node.count[k] == 0)
+					stack[stack_size++] = entry{node.child[k], tnear[k]};
+			}
+
+			// skip subtrees that start beyond a hit found since they were pushed
+			do
+			{
+				if (stack_size == 0)
+				{
+					auto &stats = thread_stats();
+					stats.node_tests += node_tests;
+					stats.primitive_tests += primitive_tests;
+					return hit_anything;
+				}
+				stack_size--;
+			} while (!(stack[stack_size].tnear <= ray_t.max));
+			current = stack[stack_size].node;
+		}
+	}
+
+private:
+	// the ray narrowed to float once per traversal
+	struct lane_ray
+	{
+		float org[3];
+		float inv[3];
+		int neg[3];
+	};
+
+	// float rounding in the slab test can shave a sliver off a box, so the exit distance is
+	// pushed out by a few ulps to keep the test conservative
+	static constexpr float exit_scale = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+
+	uint32_t collapse(const linear_bvh &tree, uint32_t root)
+	{
+		uint32_t lanes[W];
+		int n = 0;
+		const auto &binary_root = tree.nodes[root];
+		if (binary_root.is_leaf())
+			lanes[n++] = root;
+		else
+		{
+			lanes[n++] = root + 1;
+			lanes[n++] = binary_root.offset;
+		}
+
+		while (n < W)
+		{
+			int widest = -1;
+			double widest_area = -1;
+			for (int k = 0; k < n; k++)
+			{
+				const auto &node = tree.nodes[lanes[k]];
+				if (!node.is_leaf() && node.surface_area() > widest_area)
+				{
+					widest = k;
+					widest_area = node.surface_area();
+				}
+			}
+			if (widest < 0)
+				break;
+
+			uint32_t opened = lanes[widest];
+			lanes[widest] = opened + 1;
+			lanes[n++] = tree.nodes[opened].offset;
+		}
+
+		uint32_t index = uint32_t(nodes.size());
+		nodes.push_back(wide_bvh_node<W>{});
+		for (int k = 0; k < W; k++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				nodes[index].bounds[a][k] = std::numeric_limits<float>::infinity();
+				nodes[index].bounds[a + 3][k] = -std::numeric_limits<float>::infinity();
+			}
+		}
+
+		for (int k = 0; k < n; k++)
+		{
+			const auto &node = tree.nodes[lanes[k]];
+			for (int a = 0; a < 3; a++)
+			{
+				nodes[index].bounds[a][k] = node.bounds_min[a];
+				nodes[index].bounds[a + 3][k] = node.bounds_max[a];
+			}
+
+			if (node.is_leaf())
+			{
+				nodes[index].child[k] = node.offset;
+				nodes[index].count[k] = node.count;
+			}
+			else
+			{
+				uint32_t child = collapse(tree, lanes[k]);
+				nodes[index].child[k] = child;
+				nodes[index].count[k] = 0;
+			}
+		}
+		return index;
+	}
+
+	int intersect(const wide_bvh_node<W> &node, const lane_ray &lr, interval ray_t, float *tnear) const
+	{
+		float tmin = float(ray_t.min);
+		float tmax = float(ray_t.max);
+#ifdef SIMD_X86
+		if constexpr (W == 4)
+		{
+			if (kernel == bvh_kernel::sse)
+				return intersect_sse(node, lr, tmin, tmax, tnear);
+		}
+		else if constexpr (W == 8)
+		{
+			if (kernel == bvh_kernel::avx2)
+				return intersect_avx2(node, lr, tmin, tmax, tnear);
+		}
+#endif
+		return intersect_scalar(node, lr, tmin, tmax, tnear);
+	}
+
+	// The slab test picks the near and far plane of every axis from the direction sign, so an
+	// inverted box always yields an entry beyond its exit. A NaN from 0 * inf (ray on a slab
+	// plane) is dropped by the max/min, which leaves that axis unconstrained.
+	static int intersect_scalar(const wide_bvh_node<W> &node, const lane_ray &lr, float tmin, float tmax, float *tnear)
+	{
+		int mask = 0;
+		for (int k = 0; k < W; k++)
+		{
+			float t0 = tmin, t1 = tmax;
+			for (int a = 0; a < 3; a++)
+			{
+				float tn = (node.bounds[a + 3 * lr.neg[a]][k] - lr.org[a]) * lr.inv[a];
+				float tf = (node.bounds[a + 3 * (1 - lr.neg[a])][k] - lr.org[a]) * lr.inv[a];
+				t0 = tn > t0 ? tn : t0;
+				t1 = tf < t1 ? tf : t1;
+			}
+			tnear[k] = t0;
+			if (t0 <= t1 * exit_scale)
+				mask |= 1 << k;
+		}
+		return mask;
+	}
+
+#ifdef SIMD_X86
+	static int intersect_sse(const wide_bvh_node<4> &node, const lane_ray &lr, float tmin, float tmax, float *tnear)
+	{
+		__m128 t0 = _mm_set1_ps(tmin);
+		__m128 t1 = _mm_set1_ps(tmax);
+		for (int a = 0; a < 3; a++)
+		{
+			__m128 org = _mm_set1_ps(lr.org[a]);
+			__m128 inv = _mm_set1_ps(lr.inv[a]);
+			__m128 tn = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a + 3 * lr.neg[a]]), org), inv);
+			__m128 tf = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a + 3 * (1 - lr.neg[a])]), org), inv);
+			// maxps/minps return the second operand if either is NaN
+			t0 = _mm_max_ps(tn, t0);
+			t1 = _mm_min_ps(tf, t1);
+		}
+		t1 = _mm_mul_ps(t1, _mm_set1_ps(exit_scale));
+		_mm_store_ps(tnear, t0);
+		return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+	}
+
+	SIMD_TARGET_AVX2
+	static int intersect_avx2(const wide_bvh_node<8> &node, const lane_ray &lr, float tmin, float tmax, float *tnear)
+	{
+		__m256 t0 = _mm256_set1_ps(tmin);
+		__m256 t1 = _mm256_set1_ps(tmax);
+		for (int a = 0; a < 3; a++)
+		{
+			__m256 org = _mm256_set1_ps(lr.org[a]);
+			__m256 inv = _mm256_set1_ps(lr.inv[a]);
+			__m256 tn = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a + 3 * lr.neg[a]]), org), inv);
+			__m256 tf = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a + 3 * (1 - lr.neg[a])]), org), inv);
+			t0 = _mm256_max_ps(tn, t0);
+			t1 = _mm256_min_ps(tf, t1);
+		}
+		t1 = _mm256_mul_ps(t1, _mm256_set1_ps(exit_scale));
+		_mm256_store_ps(tnear, t0);
+		return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+	}
+#endif
+};
+
+// A BVH over hittable objects, flattened into one contiguous node array and traversed
+// iteratively. The objects are kept alive here; the traversal only touches raw pointers that
+// are packed in leaf order, so it does no refcounting and no recursion through virtual calls.
+class bvh_node : public hittable
+{
+private:
+	vector<shared_ptr<hittable>> objects;
+	vector<const hittable *> primitives; // objects in leaf order, indexed by slot
+	linear_bvh tree;
+	wide_bvh<4> tree4; // built instead of traversing 'tree' when options.width is 4
+	wide_bvh<8> tree8; // ... or 8
+	int width;
+	aabb bbox;
+
+public:
+	bvh_node(hittable_list list, const bvh_build_options &options = bvh_build_options())
+		: bvh_node(list.objects, 0, list.objects.size(), options) {}
+
+	bvh_node(vector<shared_ptr<hittable>> &objects, size_t st, size_t end,
+			 const bvh_build_options &options = bvh_build_options())
+		: objects(objects.begin() + st, objects.begin() + end)
+	{
+		long long count = (long long)this->objects.size();
+		vector<aabb> boxes(this->objects.size());
+#pragma omp parallel for if (count >= 16384)
+		for (long long i = 0; i < count; i++)
+			boxes[i] = this->objects[i]->bounding_box();
+
+		bbox = aabb::empty;
+		for (const auto &box : boxes)
+			bbox = aabb(bbox, box);
+
+		tree.build(boxes, options);
+
+		primitives.resize(tree.indices.size());
+		for (size_t slot = 0; slot < tree.indices.size(); slot++)
+			primitives[slot] = this->objects[tree.indices[slot]].get();
+
+		width = (options.width >= 8) ? 8 : (options.width >= 4) ? 4 : 2;
+		if (width == 4)
+			tree4.build(tree, options.simd);
+		else if (width == 8)
+			tree8.build(tree, options.simd);
+	}
+
+	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+	{
+		auto hit_primitive = [&](uint32_t slot, interval &t)
+		{
+			if (!primitives[slot]->hit(r, t, rec))
+				return false;
+			t.max = rec.t;
+			return true;
+		};
+
+		if (width == 4)
+			return tree4.traverse(r, ray_t, hit_primitive);
+		if (width == 8)
+			return tree8.traverse(r, ray_t, hit_primitive);
+		return tree.traverse(r, ray_t, hit_primitive);
+	}
+
+	// packets always walk the binary tree, whatever width the single-ray traversal uses
+	uint32_t hit_packet(ray_packet &packet, uint32_t active, hit_record *recs) const override
+	{
+		return tree.traverse_packet(packet, active, [&](uint32_t slot, uint32_t mask)
+									{ return primitives[slot]->hit_packet(packet, mask, recs); });
 	}
 
 	aabb bounding_box() const override { return bbox; }
+
+	double sah_cost() const { return tree.sah_cost(); }
+
+	// the tree's report plus the primitive pointer array kept next to it
+	void report(std::ostream &out) const
+	{
+		tree.report(out);
+		if (width == 4)
+			tree4.report(out);
+		else if (width == 8)
+			tree8.report(out);
+		out << "  plus " << primitives.capacity() * sizeof(const hittable *) / 1024.0 << "KB of primitive pointers\n";
+	}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,12 +2,21 @@
 #define CAMERA_H
 
 #include "rtweekend.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
+#include "image_writer.h"
 #include "material.h"
 #include "pdf.h"
+#include "scheduler.h"
+#include "stats.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
-#include <omp.h>
+#include <numeric>
+#include <shared_mutex>
 
 // consolidate the camera and scene-render code
 class camera
@@ -18,12 +27,21 @@ private:
 	point3 pixel00_loc;			// Location of pixel 0, 0
 	vec3 pixel_delta_u;			// Offset to pixel to the right
 	vec3 pixel_delta_v;			// Offset to pixel below
-	double pixel_samples_scale; // color scale factor of pixel samples
 	vec3 u, v, w;				// Camera frame basis vectors
 	vec3 defocus_disk_u;		// Defocus disk horizontal radius
 	vec3 defocus_disk_v;		// Defocus disk vertical radius
+	tile_scheduler scheduler;	// hands out image tiles to the render threads
+	render_stats stats;			// counters of the last render, summed over all threads
 	int    sqrt_spp;             // Square root of number of samples per pixel
 	double recip_sqrt_spp;       // 1 / sqrt_spp
+	std::vector<int> stratum_order; // strata of a pixel in the order they are sampled
+
+	framebuffer frame;					   // the samples accumulated so far
+	std::vector<pixel_variance> variances; // per pixel, row by row; only kept for adaptive sampling
+	int passes = 0;						   // passes over the image the last render took
+	std::shared_mutex frame_mutex;		   // held shared while storing a pixel, exclusively while taking a checkpoint
+	bool sample_lights = true;			   // whether scattered rays are importance sampled towards the lights
+	double sample_spread;				   // angle one sample's stratum of a pixel subtends, the spread of its ray cone
 
 	void initialize()
 	{
@@ -31,9 +49,22 @@ private:
 		image_height = (image_height < 1) ? 1 : image_height;
 
 		sqrt_spp = int(sqrt(samples_per_pixel));
-		pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
 		recip_sqrt_spp = 1.0 / sqrt_spp;
 
+		// Strata are sampled row by row, or with adaptive sampling in golden-ratio strides so that
+		// a pixel that stops early still has its samples spread over its whole area.
+		int samples = sqrt_spp * sqrt_spp;
+		int stride = 1;
+		if (adaptive)
+		{
+			stride = std::max(1, int(samples * 0.618034));
+			while (std::gcd(stride, samples) != 1)
+				stride++;
+		}
+		stratum_order.resize(samples);
+		for (int k = 0; k < samples; k++)
+			stratum_order[k] = int(int64_t(k) * stride % samples);
+
 		center = lookfrom;
 
 		// Determine viewport dimensions.
@@ -54,6 +85,7 @@ private:
 		// Calculate the horizontal and vertical delta vectors from pixel to pixel.
 		pixel_delta_u = viewport_u / image_width;
 		pixel_delta_v = viewport_v / image_height;
+		sample_spread = viewport_height / image_height / focus_dist * recip_sqrt_spp;
 
 		// Calculate the location of the upper left pixel.
 		auto viewport_upper_left =
@@ -71,6 +103,7 @@ public:
 	int image_width = 100;		// rendered image width in pixel count
 	int samples_per_pixel = 10; // count of random samples for each pixel
 	int max_depth = 10;			// Maximum number of ray bounce int the scene
+	int min_depth = 3;			// rays a path always traces before Russian roulette may end it; on by default, max_depth or more turns it off
 	color background = vec3();			// Scene background color
 
 	double vfov = 90;				   // vertial view angle (field of view)
@@ -81,55 +114,123 @@ public:
 	double defocus_angle = 0; // variation angle of rays through each pixel
 	double focus_dist = 10;	  // distance from camera lookfrom point to plane of perfect focus
 
-	void render(const hittable &world, const hittable& lights)
+	uint64_t seed = 0; // seed of the per-sample random streams, renders with the same seed are identical
+
+	int num_threads = 0;		 // render threads, 0 uses every hardware thread (or OMP_NUM_THREADS)
+	int tile_size = 32;			 // edge length in pixels of the tiles handed out to render threads
+	std::string tile_stats_path; // if set, per-tile render times are written to this CSV file
+
+	int packet_size = 1; // camera rays traced together as a packet (4, 8 or 16), 1 traces them one by one
+
+	bool adaptive = false;		 // stop sampling a pixel once it has converged; samples_per_pixel is then the maximum
+	int min_samples = 64;		 // samples every pixel takes in the first adaptive pass
+	double target_error = 0.05;	 // adaptive sampling stops at this standard error of the mean, relative to the pixel's luminance
+	std::string sample_map_path; // if set, a heatmap of the samples taken per pixel is written to this PPM file
+
+	std::string output_path = "Image.ppm"; // where the image goes, written in the background once the render is done
+	std::string output_format;			   // ppm (binary), ppm-ascii, pfm or png; empty picks it by the extension of output_path
+
+	std::string checkpoint_path;	  // if set, progress is saved here while rendering, and a render resumes from it if it exists
+	double checkpoint_interval = 600; // seconds between checkpoints
+	uint64_t scene_key = 0;			  // identifies the scene for checkpoints; the scene loaders derive it from the files they read
+
+	// Whether output_format, or the extension of output_path if it is empty, names a format
+	// there is a writer for. A render refuses to start otherwise, rather than fail at the end.
+	bool can_write_output() const
 	{
-		initialize();
+		std::string format = output_format.empty() ? format_from_path(output_path) : output_format;
+		if (make_image_writer(format))
+			return true;
+		std::cerr << "ERROR: Unknown image format '" << format << "' for '" << output_path
+				  << "', expected ppm, ppm-ascii, pfm or png.\n";
+		return false;
+	}
 
-		// һͼ
-		std::vector<std::vector<color>> colorbuffer(image_height);
-		for (int i = 0; i < image_height; i++)
-		{
-			colorbuffer[i].resize(image_width);
-		}
+	// render a scene lit only by the background and by emitters scattered rays happen to hit
+	void render(const hittable &world)
+	{
+		hittable_list no_lights;
+		sample_lights = false;
+		render(world, no_lights);
+		sample_lights = true;
+	}
 
-		int scan = 0;
+	void render(const hittable &world, const hittable& lights)
+	{
+		if (!can_write_output())
+			return;
+		initialize();
 
-		omp_set_num_threads(50); // ߳
-		#pragma omp parallel for 
-		for (int j = 0; j < image_height; j++)
+		scheduler.num_threads = num_threads;
+		scheduler.tile_size = tile_size;
+		stats = render_stats();
+		frame.reset(image_width, image_height);
+		variances.assign(adaptive ? size_t(image_width) * image_height : 0, pixel_variance());
+		std::vector<char> active(size_t(image_width) * image_height, 1);
+		passes = 0;
+
+		// A fixed render is a single pass that takes every sample. An adaptive render starts with
+		// min_samples per pixel, then doubles the budget of the pixels that haven't converged,
+		// one pass over the image at a time, until none are left or the budget is used up.
+		int samples = sqrt_spp * sqrt_spp;
+		int budget = adaptive ? std::clamp(min_samples, 1, samples) : samples;
+		if (!checkpoint_path.empty())
+			resume(budget, active);
+
+		// the first render thread to finish a tile once this time has passed takes the next checkpoint
+		using clock = std::chrono::steady_clock;
+		auto interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(checkpoint_interval));
+		std::atomic<clock::rep> next_checkpoint((clock::now() + interval).time_since_epoch().count());
+
+		while (true)
 		{
-			std::clog << "\rScanlines remaining: " << (image_height - scan) << ' ' << std::flush;
-			#pragma omp parallel for
-			for (int i = 0; i < image_width; i++)
+			passes++;
+			scheduler.run(image_width, image_height, [&](const tile &t)
 			{
-				color pixel_color(0, 0, 0);
-				for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-					for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-						ray r = get_ray(i, j, s_i, s_j);
-						pixel_color += ray_color(r, max_depth, world,lights);
-					}
+				thread_stats() = render_stats();
+				for (int j = t.y0; j < t.y1; j++)
+				{
+					for (int i = t.x0; i < t.x1; i++)
+						if (active[size_t(j) * image_width + i])
+							sample_pixel(i, j, budget, world, lights);
 				}
-				write_color(colorbuffer, i, j, pixel_samples_scale * pixel_color);
-			}
-			scan++;
+#pragma omp critical(render_stats)
+				stats.add(thread_stats());
+
+				if (!checkpoint_path.empty())
+				{
+					clock::rep now = clock::now().time_since_epoch().count();
+					clock::rep due = next_checkpoint.load();
+					if (now >= due && next_checkpoint.compare_exchange_strong(due, now + interval.count()))
+						save_checkpoint(budget, active);
+				}
+			});
+
+			if (budget >= samples || !find_unconverged(active))
+				break;
+			budget = std::min(2 * budget, samples);
 		}
 		std::clog << "\rDone.                 \n";
 
-		// ͼдppmļ
-		std::ofstream OutImage;
-		OutImage.open("Image.ppm");
-
-		OutImage << "P3\n"
-				 << image_width << ' ' << image_height << "\n255\n";
-
-		for (int j = 0; j < image_height; j++)
+		background_output().write(frame.resolve(), output_path, output_format);
+		if (!checkpoint_path.empty())
 		{
-			for (int i = 0; i < image_width; i++)
-			{
-				OutImage << colorbuffer[j][i][0] << ' ' << colorbuffer[j][i][1] << ' ' << colorbuffer[j][i][2] << '\n';
-			}
+			// nothing is left to resume once the image is on disk; until then, and if it can't be
+			// written, the checkpoint stays
+			if (background_output().wait())
+				std::remove(checkpoint_path.c_str());
+			else
+				std::cerr << "ERROR: Kept the checkpoint '" << checkpoint_path << "', the image was not written.\n";
 		}
-		OutImage.close();
+
+		scheduler.report(std::clog);
+		stats.report(std::clog);
+		if (!tile_stats_path.empty() && !scheduler.write_timings(tile_stats_path))
+			std::cerr << "ERROR: Could not write tile timings to '" << tile_stats_path << "'.\n";
+		if (adaptive)
+			report_sampling(std::clog);
+		if (!sample_map_path.empty() && !write_sample_map(sample_map_path))
+			std::cerr << "ERROR: Could not write the sample map to '" << sample_map_path << "'.\n";
 	}
 
 	// ص㣨ijȡray
@@ -168,38 +269,300 @@ public:
 		return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 	}
 
-	color ray_color(const ray &r, int depth, const hittable &world, const hittable& lights)
+	// Bring pixel (i, j) up to 'budget' samples, continuing from where it left off. Samples are
+	// traced in batches, one packet each when packets are on, and summed in double precision
+	// before they go into the framebuffer.
+	void sample_pixel(int i, int j, int budget, const hittable &world, const hittable &lights)
 	{
-		if (depth <= 0)
-			return color(0, 0, 0);
+		int batch = (packet_size > 1) ? std::min(packet_size, ray_packet::max_size) : ray_packet::max_size;
+		size_t index = size_t(j) * image_width + i;
+		int first = int(frame.at(i, j).count), count = first;
+		pixel_variance variance = adaptive ? variances[index] : pixel_variance();
+		color sum(0, 0, 0);
+		while (count < budget)
+		{
+			color colors[ray_packet::max_size];
+			int n = std::min(batch, budget - count);
+			trace_samples(i, j, &stratum_order[count], n, colors, world, lights);
+			for (int k = 0; k < n; k++)
+			{
+				sum += colors[k];
+				count++;
+				if (adaptive)
+					variance.add(luminance(colors[k]), count);
+			}
+		}
+		if (count == first)
+			return;
+
+		// a checkpoint sees either none or all of this pixel's new samples
+		std::shared_lock<std::shared_mutex> lock(frame_mutex);
+		frame.add(i, j, sum, count - first);
+		if (adaptive)
+			variances[index] = variance;
+	}
 
-		hit_record rec;
+	// the header of a checkpoint of this camera's render, without its progress
+	checkpoint_header checkpoint_settings() const
+	{
+		checkpoint_header header;
+		header.width = image_width;
+		header.height = image_height;
+		header.samples = sqrt_spp * sqrt_spp;
+		header.max_depth = max_depth;
+		header.min_depth = min_depth;
+		header.adaptive = adaptive;
+		header.min_samples = min_samples;
+		header.target_error = target_error;
+		header.seed = seed;
+		header.scene_key = scene_key;
+
+		const double view[] = {lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(),
+							   vup.x(), vup.y(), vup.z(), vfov, defocus_angle, focus_dist,
+							   background.x(), background.y(), background.z()};
+		for (double v : view)
+		{
+			uint64_t bits;
+			std::memcpy(&bits, &v, sizeof bits);
+			header.view_hash = mix_bits(header.view_hash ^ bits);
+		}
+		return header;
+	}
+
+	// save the progress of the pass in progress to checkpoint_path
+	void save_checkpoint(int budget, const std::vector<char> &active)
+	{
+		checkpoint_header header = checkpoint_settings();
+		header.pass = passes;
+		header.budget = budget;
+
+		std::string bytes;
+		{
+			std::unique_lock<std::shared_mutex> lock(frame_mutex);
+			bytes = encode_checkpoint(header, frame, active, variances);
+		}
+		if (write_checkpoint(checkpoint_path, bytes))
+			std::clog << "\rSaved a checkpoint to '" << checkpoint_path << "'.\n";
+		else
+			std::cerr << "ERROR: Could not write the checkpoint '" << checkpoint_path << "'.\n";
+	}
+
+	// Load the progress saved at checkpoint_path, if there is any, and set budget to that of the
+	// pass it was taken in. A checkpoint of some other render is ignored.
+	void resume(int &budget, std::vector<char> &active)
+	{
+		if (!std::ifstream(checkpoint_path))
+			return;
+
+		checkpoint_header header;
+		if (!read_checkpoint(checkpoint_path, checkpoint_settings(), header, frame, active, variances))
+		{
+			std::cerr << "ERROR: Could not resume from '" << checkpoint_path << "', it is damaged or belongs to another render. Starting over.\n";
+			frame.reset(image_width, image_height);
+			std::fill(active.begin(), active.end(), 1);
+			std::fill(variances.begin(), variances.end(), pixel_variance());
+			return;
+		}
+		passes = header.pass - 1;
+		budget = header.budget;
+		std::clog << "Resuming pass " << header.pass << " from '" << checkpoint_path << "'.\n";
+	}
+
+	// Mark the pixels adaptive sampling should go on sampling: those whose relative error is
+	// above target_error, and their neighbours. A pixel lit only by rare paths can look converged
+	// while all its samples so far have missed them, but its neighbours will have caught a few.
+	// Returns whether any pixel is left.
+	bool find_unconverged(std::vector<char> &active) const
+	{
+		std::vector<char> noisy(variances.size());
+		for (int j = 0; j < image_height; j++)
+		{
+			for (int i = 0; i < image_width; i++)
+			{
+				size_t index = size_t(j) * image_width + i;
+				noisy[index] = !(variances[index].relative_error(frame.at(i, j).count) <= target_error); // NaN samples never converge
+			}
+		}
+
+		bool any = false;
+		for (int j = 0; j < image_height; j++)
+		{
+			for (int i = 0; i < image_width; i++)
+			{
+				char near_noise = 0;
+				for (int y = std::max(j - 1, 0); y <= std::min(j + 1, image_height - 1); y++)
+					for (int x = std::max(i - 1, 0); x <= std::min(i + 1, image_width - 1); x++)
+						near_noise |= noisy[size_t(y) * image_width + x];
+				active[size_t(j) * image_width + i] = near_noise;
+				any = any || near_noise;
+			}
+		}
+		return any;
+	}
+
+	// Trace the camera samples of pixel (i, j) in strata[0, count), at most ray_packet::max_size
+	// of them, and store their colors.
+	// With packet_size > 1 their camera rays go through the scene as one packet; consecutive
+	// strata start at the same point and leave in nearly the same direction. Only the first hit
+	// is found per packet; shading and every bounce after it are traced ray by ray. Each lane's
+	// random stream travels with the packet and is restored before the lane is shaded, so the
+	// image matches one rendered without packets (up to volumes inside a BVH, which packets may
+	// visit in a different order).
+	void trace_samples(int i, int j, const int *strata, int count, color *colors,
+					   const hittable &world, const hittable &lights)
+	{
+		uint64_t pixel = uint64_t(j) * image_width + i;
+		if (packet_size <= 1 || max_depth <= 0)
+		{
+			for (int k = 0; k < count; k++)
+			{
+				seed_thread_rng(seed, pixel, uint64_t(strata[k]));
+				ray r = get_ray(i, j, strata[k] % sqrt_spp, strata[k] / sqrt_spp);
+				colors[k] = ray_color(r, max_depth, world, lights);
+			}
+			return;
+		}
 
-		// if the ray hits noting return teh background color
-		if (!world.hit(r, interval(0.001, infinity), rec)) return background;
+		ray_packet packet;
+		hit_record recs[ray_packet::max_size];
+		for (int k = 0; k < count; k++)
+		{
+			seed_thread_rng(seed, pixel, uint64_t(strata[k]));
+			packet.add(get_ray(i, j, strata[k] % sqrt_spp, strata[k] / sqrt_spp), interval(0.001, infinity));
+		}
 
-		scatter_record srec;
-		color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+		thread_stats().rays += packet.size;
+		uint32_t hits = world.hit_packet(packet, packet.lanes(), recs);
+		for (int k = 0; k < count; k++)
+		{
+			thread_rng() = packet.rng[k];
+			colors[k] = trace_path(packet.rays[k], (hits >> k) & 1, recs[k], max_depth, world, lights);
+		}
+	}
 
+	// how many samples adaptive sampling spent, against the fixed budget
+	void report_sampling(std::ostream &out) const
+	{
+		int samples = sqrt_spp * sqrt_spp;
+		uint64_t total = 0, at_max = 0;
+		for (int j = 0; j < image_height; j++)
+		{
+			for (int i = 0; i < image_width; i++)
+			{
+				uint32_t count = frame.at(i, j).count;
+				total += count;
+				at_max += (count == uint32_t(samples));
+			}
+		}
+		double pixels = double(image_width) * image_height;
+		out << "adaptive sampling: " << passes << " passes, " << total / pixels << " samples per pixel on average (max " << samples << "), "
+			<< 100.0 * total / (pixels * samples) << "% of the fixed budget, "
+			<< 100.0 * at_max / pixels << "% of pixels at the max\n";
+	}
 
-		if (!rec.mat->scatter(r, rec, srec)) return color_from_emission;
+	// write the samples taken per pixel as a heatmap from black (none) over red and yellow to
+	// white (samples_per_pixel)
+	bool write_sample_map(const std::string &path) const
+	{
+		std::ofstream out(path);
+		if (!out)
+			return false;
 
-		if (srec.skip_pdf) {
-			return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+		int samples = sqrt_spp * sqrt_spp;
+		out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+		for (int j = 0; j < image_height; j++)
+		{
+			for (int i = 0; i < image_width; i++)
+			{
+				double t = double(frame.at(i, j).count) / samples;
+				auto ramp = [t](double offset) { return int(255 * std::clamp(3 * t - offset, 0.0, 1.0)); };
+				out << ramp(0) << ' ' << ramp(1) << ' ' << ramp(2) << '\n';
+			}
 		}
+		return true;
+	}
+
+	color ray_color(const ray &r, int depth, const hittable &world, const hittable& lights)
+	{
+		if (depth <= 0)
+			return color(0, 0, 0);
+
+		hit_record rec;
 
-		auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-		mixture_pdf p(light_ptr, srec.pdf_ptr);
+		thread_stats().rays++;
+		bool hit = world.hit(r, interval(0.001, infinity), rec);
+		return trace_path(r, hit, rec, depth, world, lights);
+	}
 
-		ray scattered = ray(rec.p, p.generate(), r.time());
-		auto pdf_val = p.value(scattered.direction());
+	// Follow the path that starts with ray r, whose first intersection (if any) is already known,
+	// for at most 'depth' rays. Rather than recursing per bounce, the loop carries the product of
+	// the path's attenuations so far (its throughput). After min_depth rays, Russian roulette lets
+	// a path go on with probability equal to its largest throughput component and divides the
+	// throughput by that probability, so dim paths end early without biasing the image.
+	color trace_path(ray r, bool hit, hit_record rec, int depth, const hittable &world, const hittable &lights)
+	{
+		color radiance(0, 0, 0);
+		color throughput(1, 1, 1);
+		double cone_length = 0; // of the path so far, for the width of its ray cone
+		auto &stats = thread_stats();
+		stats.paths++;
 
-		double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+		for (int bounce = 1;; bounce++)
+		{
+			// if the ray hits noting return teh background color
+			if (!hit)
+			{
+				radiance += throughput * background;
+				break;
+			}
 
-		color sample_color = ray_color(scattered, depth - 1, world, lights);
-		color color_from_scatter = (srec.attenuation * scattering_pdf * sample_color) / pdf_val;
+			// Textures are filtered over the ray cone where it meets the surface, widened along the
+			// surface at grazing angles. The cone keeps the camera's spread across bounces, which
+			// underestimates it after rough ones: textures then come out sharper, never blurrier.
+			double speed = r.direction().length();
+			cone_length += rec.t * speed;
+			double cosine = fmax(fabs(dot(r.direction(), rec.normal)) / speed, 0.1);
+			rec.footprint = sample_spread * cone_length * rec.uv_scale / cosine;
+
+			scatter_record srec;
+			radiance += throughput * rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+			if (!rec.mat->scatter(r, rec, srec))
+				break;
+
+			ray scattered;
+			if (srec.skip_pdf)
+			{
+				scattered = srec.skip_pdf_ray;
+				throughput = throughput * srec.attenuation;
+			}
+			else
+			{
+				hittable_pdf light_pdf(lights, rec.p);
+				mixture_pdf mixture(light_pdf, *srec.pdf_ptr());
+				const pdf &p = sample_lights ? static_cast<const pdf &>(mixture) : *srec.pdf_ptr();
+
+				scattered = ray(rec.p, p.generate(), r.time());
+				auto pdf_val = p.value(scattered.direction());
+				double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+				throughput = throughput * srec.attenuation * scattering_pdf / pdf_val;
+			}
 
-		return color_from_emission + color_from_scatter;
+			if (bounce >= depth)
+				break;
+
+			if (bounce >= min_depth)
+			{
+				double survival = fmin(1.0, fmax(throughput.x(), fmax(throughput.y(), throughput.z())));
+				if (random_double() >= survival)
+					break;
+				throughput /= survival;
+			}
+
+			r = scattered;
+			stats.rays++;
+			hit = world.hit(r, interval(0.001, infinity), rec);
+		}
+		return radiance;
 	}
 };
 
@@ -0,0 +1,98 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Saved progress of a render, so a long render can be picked up where it stopped.
+//
+// Every camera sample reseeds the random generator from (seed, pixel, sample index), so the seed
+// and the sample count of each pixel stand in for the random state: a resumed render draws
+// exactly the numbers the interrupted one would have, and ends with the same image.
+//
+// The file is the header followed by, row by row, every pixel's framebuffer entry, then one byte
+// per pixel that is 1 if the pass in progress samples it, then for adaptive renders every
+// pixel's pixel_variance. Everything is in the native byte order.
+struct checkpoint_header
+{
+	char magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\n', '\0'};
+	uint32_t version = 2;
+
+	// the settings the progress is only valid for
+	int32_t width = 0, height = 0, samples = 0;
+	int32_t max_depth = 0, min_depth = 0;
+	int32_t adaptive = 0, min_samples = 0;
+	double target_error = 0;
+	uint64_t seed = 0;
+	uint64_t view_hash = 0; // hash of the camera's view parameters
+	uint64_t scene_key = 0; // the camera's scene_key
+
+	// the pass in progress
+	int32_t pass = 0, budget = 0;
+
+	bool same_settings(const checkpoint_header &other) const
+	{
+		return std::memcmp(magic, other.magic, sizeof magic) == 0 && version == other.version &&
+			   width == other.width && height == other.height && samples == other.samples &&
+			   max_depth == other.max_depth && min_depth == other.min_depth &&
+			   adaptive == other.adaptive && min_samples == other.min_samples &&
+			   target_error == other.target_error && seed == other.seed && view_hash == other.view_hash &&
+			   scene_key == other.scene_key;
+	}
+};
+
+// Encode a checkpoint into memory. The camera does this while no thread is writing pixels, and
+// writes the bytes out afterwards.
+inline std::string encode_checkpoint(const checkpoint_header &header, const framebuffer &frame,
+									 const std::vector<char> &active, const std::vector<pixel_variance> &variances)
+{
+	std::string bytes;
+	bytes.reserve(sizeof header + size_t(header.width) * header.height * (sizeof(framebuffer::pixel) + 1) +
+				  variances.size() * sizeof(pixel_variance));
+	bytes.append(reinterpret_cast<const char *>(&header), sizeof header);
+	for (int j = 0; j < header.height; j++)
+		bytes.append(reinterpret_cast<const char *>(&frame.at(0, j)), sizeof(framebuffer::pixel) * header.width);
+	bytes.append(active.data(), active.size());
+	bytes.append(reinterpret_cast<const char *>(variances.data()), variances.size() * sizeof(pixel_variance));
+	return bytes;
+}
+
+// Write an encoded checkpoint to path. It goes to a temporary file first, which then replaces
+// path, so an interruption while writing leaves the previous checkpoint intact.
+inline bool write_checkpoint(const std::string &path, const std::string &bytes)
+{
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary);
+		if (!out.write(bytes.data(), std::streamsize(bytes.size())).flush())
+			return false;
+	}
+	if (std::rename(temp.c_str(), path.c_str()) == 0)
+		return true;
+	std::remove(path.c_str()); // rename won't replace an existing file everywhere
+	return std::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+// Read the checkpoint at path into header, frame, active and variances, which must already be
+// sized for the render. Fails if the file is damaged or was saved with settings other than
+// expected's.
+inline bool read_checkpoint(const std::string &path, const checkpoint_header &expected, checkpoint_header &header,
+							framebuffer &frame, std::vector<char> &active, std::vector<pixel_variance> &variances)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in.read(reinterpret_cast<char *>(&header), sizeof header) || !header.same_settings(expected))
+		return false;
+	for (int j = 0; j < header.height; j++)
+		in.read(reinterpret_cast<char *>(&frame.at(0, j)), sizeof(framebuffer::pixel) * header.width);
+	in.read(active.data(), std::streamsize(active.size()));
+	in.read(reinterpret_cast<char *>(variances.data()), std::streamsize(variances.size() * sizeof(pixel_variance)));
+	return bool(in) && in.peek() == std::char_traits<char>::eof();
+}
+
+#endif
@@ -15,8 +15,14 @@ inline double linear_to_gamma(double linear_component)
 	return 0;
 }
 
-// print the color value of the specific pixel
-void write_color(std::vector<std::vector<color>> &colorbuffer, int i, int j, const color &pixel_color)
+// perceived brightness of a linear color (Rec. 709 weights)
+inline double luminance(const color &c)
+{
+	return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// gamma-encode a linear pixel color and quantize it to the bytes out[0..2]
+inline void write_color(unsigned char *out, const color &pixel_color)
 {
 	auto r = pixel_color.x();
 	auto g = pixel_color.y();
@@ -34,14 +40,9 @@ void write_color(std::vector<std::vector<color>> &colorbuffer, int i, int j, con
 
 	// Translate the [0,1] component values to the byte range [0,255].
 	static const interval intensity(0.000, 0.999);
-	int rbyte = int(256 * intensity.clamp(r));
-	int gbyte = int(256 * intensity.clamp(g));
-	int bbyte = int(256 * intensity.clamp(b));
-
-	// write out the pixel color components.
-	colorbuffer[j][i][0] = rbyte;
-	colorbuffer[j][i][1] = gbyte;
-	colorbuffer[j][i][2] = bbyte;
+	out[0] = (unsigned char)(256 * intensity.clamp(r));
+	out[1] = (unsigned char)(256 * intensity.clamp(g));
+	out[2] = (unsigned char)(256 * intensity.clamp(b));
 }
 
 #endif
\ No newline at end of file
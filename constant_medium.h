@@ -5,18 +5,19 @@
 
 #include "hittable.h"
 #include "material.h"
+#include "material_table.h"
 #include "texture.h"
 
 class constant_medium : public hittable {
 public:
     constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex)
         : boundary(boundary), neg_inv_density(-1 / density),
-        phase_function(make_shared<isotropic>(tex))
+        phase_function(material_table::global().add(make_shared<isotropic>(tex)))
     {}
 
     constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
         : boundary(boundary), neg_inv_density(-1 / density),
-        phase_function(make_shared<isotropic>(albedo))
+        phase_function(material_table::global().add(make_shared<isotropic>(albedo)))
     {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
@@ -62,6 +63,7 @@ public:
         rec.normal = vec3(1, 0, 0);  // arbitrary
         rec.front_face = true;     // also arbitrary
         rec.mat = phase_function;
+        rec.uv_scale = 0;
 
         return true;
     }
@@ -71,7 +73,7 @@ public:
 private:
     shared_ptr<hittable> boundary;
     double neg_inv_density;
-    shared_ptr<material> phase_function;
+    const material *phase_function; // owned by material_table
 };
 
 #endif
\ No newline at end of file
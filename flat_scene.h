@@ -0,0 +1,632 @@
+#ifndef FLAT_SCENE_H
+#define FLAT_SCENE_H
+
+#include "rtweekend.h"
+#include "affine.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A scene as plain records in flat arrays, with no pointers between them: shapes refer to
+// materials, materials to textures and media to their boundaries by index. Transforms are baked
+// into the shapes. This is the form a scene cache stores, and flat_scene renders straight from
+// the arrays wherever they live, e.g. in a mapped file.
+//
+// Meshes keep their vertices in shared arrays, one per attribute, and their triangles are index
+// triples into them.
+//
+// Shapes are named by a primitive id, whose top two bits are the kind of shape and the rest its
+// index in the array of that kind.
+enum flat_kind : uint32_t
+{
+	flat_sphere_kind = 0,
+	flat_quad_kind = 1,
+	flat_medium_kind = 2,
+	flat_triangle_kind = 3
+};
+
+constexpr uint32_t flat_none = 0xffffffff; // no material or texture
+
+inline uint32_t flat_id(uint32_t kind, size_t index) { return kind << 30 | uint32_t(index); }
+inline uint32_t flat_kind_of(uint32_t id) { return id >> 30; }
+inline uint32_t flat_index_of(uint32_t id) { return id & 0x3fffffff; }
+
+struct flat_texture
+{
+	enum kind_t : uint32_t
+	{
+		solid,
+		checker,
+		image,
+		noise,
+		blend
+	};
+	uint32_t kind = solid;
+	uint32_t even = flat_none, odd = flat_none; // checker: the textures of the two kinds of cells, blend: the two mixed
+	uint32_t name = 0;							// image: offset of the file name in the string table
+	uint32_t octaves = 0;						// noise: of turbulence, 0 for plain noise
+	double scale = 1;							// checker and noise; blend: the amount of odd
+	color albedo;								// solid
+};
+
+struct flat_material
+{
+	enum kind_t : uint32_t
+	{
+		lambertian,
+		metal,
+		dielectric,
+		light,
+		isotropic
+	};
+	uint32_t kind = lambertian;
+	uint32_t texture = flat_none; // lambertian, light and isotropic
+	double param = 0;			  // metal: fuzz, dielectric: refraction index
+	color albedo;				  // metal
+};
+
+struct flat_sphere
+{
+	point3 center; // at time 0
+	vec3 motion;   // center at time 1 minus center at time 0
+	double radius;
+	vec3 to_object[3]; // rows of the rotation baked into the sphere, back to its own space for the texture
+	uint32_t material;
+	uint32_t pad;
+};
+
+struct flat_quad
+{
+	point3 Q;
+	vec3 u, v;
+	vec3 w, normal; // derived from u and v as in quad
+	double D;
+	uint32_t material;
+	uint32_t pad;
+};
+
+// the arrays of the vertex attributes, each indexed by vertex
+enum flat_vertex_attribute : uint32_t
+{
+	vertex_x,
+	vertex_y,
+	vertex_z,
+	normal_x, // the shading normal, zero for a mesh without normals
+	normal_y,
+	normal_z,
+	vertex_u, // the texture coordinates, zero for a mesh without them
+	vertex_v,
+	vertex_attribute_count
+};
+
+struct flat_triangle
+{
+	enum flags_t : uint32_t
+	{
+		has_normals = 1,
+		has_uvs = 2
+	};
+	uint32_t v[3]; // the corners, counterclockwise from the front
+	uint32_t material;
+	uint32_t flags; // of the mesh the triangle comes from
+};
+
+// a file other than the scene file that went into the arrays, such as a mesh
+struct flat_dependency
+{
+	uint32_t name; // offset of the path in the string table
+	uint32_t pad;
+	uint64_t key; // of the file when it was read, see file_source_key()
+};
+
+struct flat_medium
+{
+	uint32_t first, count; // the boundary's primitive ids, in flat_scene_data::medium_ids
+	double density;
+	uint32_t texture;
+	uint32_t pad;
+};
+
+inline aabb flat_bounds(const flat_sphere &s)
+{
+	vec3 rvec(s.radius, s.radius, s.radius);
+	point3 end = s.center + s.motion;
+	return aabb(aabb(s.center - rvec, s.center + rvec), aabb(end - rvec, end + rvec));
+}
+
+inline aabb flat_bounds(const flat_quad &q)
+{
+	return aabb(aabb(q.Q, q.Q + q.u + q.v), aabb(q.Q + q.u, q.Q + q.v));
+}
+
+// identifies the contents of the file at path by its size and modification time, 0 if it can't
+// be read
+inline uint64_t file_source_key(const std::string &path)
+{
+	std::error_code error;
+	auto size = std::filesystem::file_size(path, error);
+	if (error)
+		return 0;
+	auto time = std::filesystem::last_write_time(path, error);
+	if (error)
+		return 0;
+	return mix_bits(mix_bits(size) ^ uint64_t(time.time_since_epoch().count())) | 1;
+}
+
+// Pointers to the arrays of a flat scene, and what intersecting its primitives needs.
+struct flat_geometry
+{
+	const flat_sphere *spheres = nullptr;
+	const flat_quad *quads = nullptr;
+	const flat_triangle *triangles = nullptr;
+	const double *vertices[vertex_attribute_count] = {};
+	const flat_medium *media = nullptr;
+	const uint32_t *medium_ids = nullptr;
+	const material *const *materials = nullptr; // indexed by material index
+	const hittable *const *volumes = nullptr;	// the constant_medium of every medium
+
+	aabb bounds(uint32_t id) const
+	{
+		uint32_t index = flat_index_of(id);
+		switch (flat_kind_of(id))
+		{
+		case flat_sphere_kind:
+			return flat_bounds(spheres[index]);
+		case flat_quad_kind:
+			return flat_bounds(quads[index]);
+		case flat_triangle_kind:
+		{
+			const flat_triangle &t = triangles[index];
+			return aabb(aabb(position(t.v[0]), position(t.v[1])), aabb(position(t.v[2]), position(t.v[2])));
+		}
+		default:
+		{
+			const flat_medium &m = media[index];
+			aabb box = aabb::empty;
+			for (uint32_t k = m.first; k < m.first + m.count; k++)
+				box = aabb(box, bounds(medium_ids[k]));
+			return box;
+		}
+		}
+	}
+
+	point3 position(uint32_t k) const { return point3(vertices[vertex_x][k], vertices[vertex_y][k], vertices[vertex_z][k]); }
+	vec3 normal(uint32_t k) const { return vec3(vertices[normal_x][k], vertices[normal_y][k], vertices[normal_z][k]); }
+
+	// intersect primitive id, as its hittable would; wr is r prepared for triangles
+	bool hit(uint32_t id, const ray &r, const watertight_ray &wr, interval ray_t, hit_record &rec) const
+	{
+		uint32_t index = flat_index_of(id);
+		switch (flat_kind_of(id))
+		{
+		case flat_sphere_kind:
+		{
+			const flat_sphere &s = spheres[index];
+			point3 center = s.center + r.time() * s.motion;
+			double root;
+			if (!sphere::intersect(r, ray_t, center, s.radius, root))
+				return false;
+			rec.t = root;
+			rec.p = r.at(root);
+			vec3 outward_normal = (rec.p - center) / s.radius;
+			rec.set_face_normal(r, outward_normal);
+			rec.mat = material_at(s.material);
+			// texture coordinates of the unrotated sphere
+			vec3 n(dot(s.to_object[0], outward_normal), dot(s.to_object[1], outward_normal),
+				   dot(s.to_object[2], outward_normal));
+			sphere::get_sphere_uv(n, rec.u, rec.v);
+			rec.uv_scale = 1 / (pi * s.radius);
+			return true;
+		}
+		case flat_quad_kind:
+		{
+			const flat_quad &q = quads[index];
+			double t, alpha, beta;
+			if (!quad::intersect(r, ray_t, q.Q, q.u, q.v, q.w, q.normal, q.D, t, alpha, beta))
+				return false;
+			if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1)
+				return false;
+			rec.u = alpha;
+			rec.v = beta;
+			rec.t = t;
+			rec.p = r.at(t);
+			rec.mat = material_at(q.material);
+			rec.set_face_normal(r, q.normal);
+			rec.uv_scale = sqrt(q.w.length()); // |w| is 1 / area
+			return true;
+		}
+		case flat_triangle_kind:
+		{
+			const flat_triangle &tri = triangles[index];
+			const uint32_t *v = tri.v;
+			point3 p0 = position(v[0]), p1 = position(v[1]), p2 = position(v[2]);
+			double t, b1, b2;
+			if (!triangle_mesh::intersect(wr, ray_t, p0, p1, p2, t, b1, b2))
+				return false;
+			// shaded as triangle_mesh shades
+			double b0 = 1 - b1 - b2;
+			rec.t = t;
+			rec.p = r.at(t);
+			rec.mat = material_at(tri.material);
+			rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+			if (tri.flags & flat_triangle::has_normals)
+			{
+				vec3 n = unit_vector(b0 * normal(v[0]) + b1 * normal(v[1]) + b2 * normal(v[2]));
+				rec.normal = rec.front_face ? n : -n;
+			}
+			if (tri.flags & flat_triangle::has_uvs)
+			{
+				const double *tu = vertices[vertex_u], *tv = vertices[vertex_v];
+				rec.u = b0 * tu[v[0]] + b1 * tu[v[1]] + b2 * tu[v[2]];
+				rec.v = b0 * tv[v[0]] + b1 * tv[v[1]] + b2 * tv[v[2]];
+				rec.uv_scale = triangle_mesh::uv_scale(p1 - p0, p2 - p0, tu[v[1]] - tu[v[0]], tv[v[1]] - tv[v[0]],
+													   tu[v[2]] - tu[v[0]], tv[v[2]] - tv[v[0]]);
+			}
+			else
+			{
+				rec.u = b1;
+				rec.v = b2;
+				rec.uv_scale = triangle_mesh::uv_scale(p1 - p0, p2 - p0, 1, 0, 0, 1);
+			}
+			return true;
+		}
+		default:
+			return volumes[index]->hit(r, ray_t, rec);
+		}
+	}
+
+	// the nearest hit among 'count' primitives listed at ids
+	bool hit_any(const uint32_t *ids, uint32_t count, const ray &r, interval ray_t, hit_record &rec) const
+	{
+		watertight_ray wr(r);
+		bool hit_anything = false;
+		for (uint32_t k = 0; k < count; k++)
+		{
+			if (hit(ids[k], r, wr, ray_t, rec))
+			{
+				hit_anything = true;
+				ray_t.max = rec.t;
+			}
+		}
+		return hit_anything;
+	}
+
+private:
+	const material *material_at(uint32_t index) const { return index == flat_none ? nullptr : materials[index]; }
+};
+
+// The boundary of a medium in a flat scene: a few primitives tested one by one.
+class flat_boundary : public hittable
+{
+public:
+	flat_boundary(const flat_geometry &geometry, const flat_medium &medium) : geometry(geometry), medium(medium)
+	{
+		bbox = aabb::empty;
+		for (uint32_t k = medium.first; k < medium.first + medium.count; k++)
+			bbox = aabb(bbox, geometry.bounds(geometry.medium_ids[k]));
+	}
+
+	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+	{
+		return geometry.hit_any(geometry.medium_ids + medium.first, medium.count, r, ray_t, rec);
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+private:
+	const flat_geometry &geometry;
+	flat_medium medium;
+	aabb bbox;
+};
+
+// A scene as flat arrays held in memory: what the scene parser records for a cache, and the
+// building blocks for turning records back into textures and materials.
+struct flat_scene_data
+{
+	std::vector<flat_texture> textures;
+	std::vector<flat_material> materials;
+	std::vector<flat_sphere> spheres;
+	std::vector<flat_quad> quads;
+	std::vector<flat_triangle> triangles;
+	std::vector<double> vertices[vertex_attribute_count];
+	std::vector<flat_medium> media;
+	std::vector<uint32_t> medium_ids; // the boundaries of the media
+	std::vector<uint32_t> world;	  // the primitives making up the scene
+	std::vector<uint32_t> lights;	  // the primitives scattered rays are sampled towards
+	std::vector<flat_dependency> dependencies;
+	std::string strings; // null-terminated strings
+
+	uint32_t add_string(std::string_view s)
+	{
+		uint32_t offset = uint32_t(strings.size());
+		strings.append(s);
+		strings.push_back('\0');
+		return offset;
+	}
+
+	// record that the arrays depend on the file at path, as it is now
+	void add_dependency(const std::string &path)
+	{
+		dependencies.push_back(flat_dependency{add_string(path), 0, file_source_key(path)});
+	}
+
+	uint32_t add_sphere(const point3 &center, const vec3 &motion, double radius, uint32_t material)
+	{
+		spheres.push_back(flat_sphere{center, motion, fmax(0, radius), {vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)},
+									  material, 0});
+		return flat_id(flat_sphere_kind, spheres.size() - 1);
+	}
+
+	uint32_t add_quad(const point3 &Q, const vec3 &u, const vec3 &v, uint32_t material)
+	{
+		flat_quad q{Q, u, v, vec3(), vec3(), 0, material, 0};
+		derive(q);
+		quads.push_back(q);
+		return flat_id(flat_quad_kind, quads.size() - 1);
+	}
+
+	// the six sides of the box with opposite corners a and b, as box() makes them
+	void add_box(const point3 &a, const point3 &b, uint32_t material, std::vector<uint32_t> &ids)
+	{
+		auto min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
+		auto max = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
+
+		auto dx = vec3(max.x() - min.x(), 0, 0);
+		auto dy = vec3(0, max.y() - min.y(), 0);
+		auto dz = vec3(0, 0, max.z() - min.z());
+
+		ids.push_back(add_quad(point3(min.x(), min.y(), max.z()), dx, dy, material));
+		ids.push_back(add_quad(point3(max.x(), min.y(), max.z()), -dz, dy, material));
+		ids.push_back(add_quad(point3(max.x(), min.y(), min.z()), -dx, dy, material));
+		ids.push_back(add_quad(point3(min.x(), min.y(), min.z()), dz, dy, material));
+		ids.push_back(add_quad(point3(min.x(), max.y(), max.z()), dx, -dz, material));
+		ids.push_back(add_quad(point3(min.x(), min.y(), min.z()), dx, dz, material));
+	}
+
+	uint32_t vertex_count() const { return uint32_t(vertices[vertex_x].size()); }
+
+	// append a vertex to the shared arrays and return its index
+	uint32_t add_vertex(const point3 &p, const vec3 &n, double u, double v)
+	{
+		const double values[vertex_attribute_count] = {p.x(), p.y(), p.z(), n.x(), n.y(), n.z(), u, v};
+		for (uint32_t a = 0; a < vertex_attribute_count; a++)
+			vertices[a].push_back(values[a]);
+		return vertex_count() - 1;
+	}
+
+	// the vertices of a mesh, appended to the shared arrays, and its triangles
+	void add_mesh(const mesh_data &mesh, uint32_t material, std::vector<uint32_t> &ids)
+	{
+		uint32_t first = vertex_count();
+		for (uint32_t k = 0; k < mesh.vertex_count(); k++)
+			add_vertex(mesh.position(k), mesh.has_normals() ? mesh.normal(k) : vec3(0, 0, 0),
+					   mesh.has_uvs() ? mesh.tu[k] : 0, mesh.has_uvs() ? mesh.tv[k] : 0);
+		uint32_t flags = (mesh.has_normals() ? uint32_t(flat_triangle::has_normals) : 0) | (mesh.has_uvs() ? uint32_t(flat_triangle::has_uvs) : 0);
+		for (size_t k = 0; k < mesh.triangle_count(); k++)
+		{
+			const uint32_t *c = &mesh.indices[3 * k];
+			triangles.push_back(flat_triangle{{first + c[0], first + c[1], first + c[2]}, material, flags});
+			ids.push_back(flat_id(flat_triangle_kind, triangles.size() - 1));
+		}
+	}
+
+	uint32_t add_medium(const std::vector<uint32_t> &boundary, double density, uint32_t texture)
+	{
+		media.push_back(flat_medium{uint32_t(medium_ids.size()), uint32_t(boundary.size()), density, texture, 0});
+		medium_ids.insert(medium_ids.end(), boundary.begin(), boundary.end());
+		return flat_id(flat_medium_kind, media.size() - 1);
+	}
+
+	// Copies of the primitives 'ids' under 'map', appended to 'out'. Triangles sharing a vertex
+	// share its copy too. Spheres only stay spheres under maps that scale all directions alike;
+	// see keeps_shape().
+	void transformed(const std::vector<uint32_t> &ids, const affine3 &map, std::vector<uint32_t> &out)
+	{
+		double scale = 1;
+		map.is_similarity(scale);
+		// a rigid map keeps its exact terms, so a sphere under rotate_y gets the same numbers as
+		// the hittable uses
+		if (fabs(scale - 1) < 1e-12)
+			scale = 1;
+		affine3 inverse = map.inverse();
+		std::unordered_map<uint32_t, uint32_t> vertex_copies;
+		for (uint32_t id : ids)
+			out.push_back(transformed(id, map, inverse, scale, vertex_copies));
+	}
+
+	// whether primitive id can be put under 'map'
+	bool keeps_shape(uint32_t id, const affine3 &map) const
+	{
+		double scale;
+		if (map.is_similarity(scale))
+			return true;
+		if (flat_kind_of(id) == flat_sphere_kind)
+			return false;
+		if (flat_kind_of(id) != flat_medium_kind)
+			return true;
+		const flat_medium &m = media[flat_index_of(id)];
+		for (uint32_t k = m.first; k < m.first + m.count; k++)
+			if (!keeps_shape(medium_ids[k], map))
+				return false;
+		return true;
+	}
+
+private:
+	static void derive(flat_quad &q)
+	{
+		auto n = cross(q.u, q.v);
+		q.normal = unit_vector(n);
+		q.D = dot(q.normal, q.Q);
+		q.w = n / dot(n, n);
+	}
+
+	uint32_t transformed(uint32_t id, const affine3 &map, const affine3 &inverse, double scale,
+						 std::unordered_map<uint32_t, uint32_t> &vertex_copies)
+	{
+		uint32_t index = flat_index_of(id);
+		switch (flat_kind_of(id))
+		{
+		case flat_sphere_kind:
+		{
+			flat_sphere s = spheres[index];
+			s.center = map.point(s.center);
+			s.motion = map.vector(s.motion);
+			s.radius *= scale;
+			// compose the rotation part of the map into the texture's
+			double inv_scale = 1 / scale;
+			vec3 to_object[3];
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					to_object[i][j] = dot(s.to_object[i], vec3(map.m[j][0], map.m[j][1], map.m[j][2])) * inv_scale;
+			for (int i = 0; i < 3; i++)
+				s.to_object[i] = to_object[i];
+			spheres.push_back(s);
+			return flat_id(flat_sphere_kind, spheres.size() - 1);
+		}
+		case flat_quad_kind:
+		{
+			flat_quad q = quads[index];
+			q.Q = map.point(q.Q);
+			q.u = map.vector(q.u);
+			q.v = map.vector(q.v);
+			derive(q);
+			quads.push_back(q);
+			return flat_id(flat_quad_kind, quads.size() - 1);
+		}
+		case flat_triangle_kind:
+		{
+			flat_triangle t = triangles[index];
+			for (uint32_t &k : t.v)
+			{
+				auto [copy, added] = vertex_copies.try_emplace(k, 0);
+				if (added)
+				{
+					auto value = [&](flat_vertex_attribute a) { return vertices[a][k]; };
+					vec3 n(value(normal_x), value(normal_y), value(normal_z));
+					if (t.flags & flat_triangle::has_normals)
+						n = unit_vector(inverse.transposed_vector(n));
+					point3 p = map.point(point3(value(vertex_x), value(vertex_y), value(vertex_z)));
+					copy->second = add_vertex(p, n, value(vertex_u), value(vertex_v));
+				}
+				k = copy->second;
+			}
+			triangles.push_back(t);
+			return flat_id(flat_triangle_kind, triangles.size() - 1);
+		}
+		default:
+		{
+			flat_medium m = media[index];
+			std::vector<uint32_t> boundary;
+			for (uint32_t k = m.first; k < m.first + m.count; k++)
+				boundary.push_back(transformed(medium_ids[k], map, inverse, scale, vertex_copies));
+			return add_medium(boundary, m.density, m.texture);
+		}
+		}
+	}
+};
+
+// Make the texture of a record; 'made' holds the textures of the records before it, which a
+// checker may refer to, and strings the string table.
+inline shared_ptr<texture> make_texture(const flat_texture &t, const std::vector<shared_ptr<texture>> &made,
+										const char *strings)
+{
+	switch (t.kind)
+	{
+	case flat_texture::checker:
+		return make_shared<checker_texture>(t.scale, made[t.even], made[t.odd]);
+	case flat_texture::image:
+		return make_shared<image_texture>(strings + t.name);
+	case flat_texture::noise:
+		return make_shared<noise_texture>(t.scale, int(t.octaves));
+	case flat_texture::blend:
+		return make_shared<blend_texture>(made[t.even], made[t.odd], t.scale);
+	default:
+		return make_shared<solid_color>(t.albedo);
+	}
+}
+
+// make the material of a record whose textures are in 'textures'
+inline shared_ptr<material> make_material(const flat_material &m, const std::vector<shared_ptr<texture>> &textures)
+{
+	switch (m.kind)
+	{
+	case flat_material::metal:
+		return make_shared<metal>(m.albedo, m.param);
+	case flat_material::dielectric:
+		return make_shared<dielectric>(m.param);
+	case flat_material::light:
+		return make_shared<diffuse_light>(textures[m.texture]);
+	case flat_material::isotropic:
+		return make_shared<isotropic>(textures[m.texture]);
+	default:
+		return make_shared<lambertian>(textures[m.texture]);
+	}
+}
+
+// A whole scene rendered from flat arrays under a prebuilt BVH. The hittable allocates nothing
+// per primitive: only the materials and the media become objects. 'storage' keeps the arrays
+// alive, e.g. the mapped file they point into.
+class flat_scene : public hittable
+{
+public:
+	flat_scene(const flat_geometry &arrays, const linear_bvh_node *nodes, const uint32_t *slots, size_t medium_count,
+			   const std::vector<shared_ptr<texture>> &textures, std::vector<shared_ptr<material>> materials_in,
+			   shared_ptr<const void> storage)
+		: geometry(arrays), nodes(nodes), slots(slots), materials(std::move(materials_in)), storage(std::move(storage))
+	{
+		for (const auto &m : materials)
+			material_pointers.push_back(m.get());
+		geometry.materials = material_pointers.data();
+
+		for (size_t k = 0; k < medium_count; k++)
+		{
+			const flat_medium &m = geometry.media[k];
+			media.push_back(make_shared<constant_medium>(make_shared<flat_boundary>(geometry, m), m.density,
+														 textures[m.texture]));
+			volume_pointers.push_back(media.back().get());
+		}
+		geometry.volumes = volume_pointers.data();
+
+		const linear_bvh_node &root = nodes[0];
+		bbox = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+					point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+	}
+
+	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+	{
+		watertight_ray wr(r);
+		return linear_bvh::traverse(nodes, r, ray_t, [&](uint32_t slot, interval &t)
+									{
+			if (!geometry.hit(slots[slot], r, wr, t, rec))
+				return false;
+			t.max = rec.t;
+			return true; });
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	const flat_geometry &arrays() const { return geometry; }
+
+private:
+	flat_geometry geometry;
+	const linear_bvh_node *nodes;
+	const uint32_t *slots;
+	std::vector<shared_ptr<material>> materials;
+	std::vector<const material *> material_pointers;
+	std::vector<shared_ptr<hittable>> media;
+	std::vector<const hittable *> volume_pointers;
+	shared_ptr<const void> storage;
+	aabb bbox;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "aligned_array.h"
+#include "color.h"
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// The radiance accumulated per pixel: the linear RGB sum of its samples and how many were taken.
+// All pixels live in one allocation aligned to a cache line, with rows padded to whole lines, so
+// threads filling different tiles never write to the same cache line as long as tile edges are a
+// multiple of pixels_per_line (the default 32 is). The buffer holds sums only; averaging,
+// tonemapping and quantization happen when an image is resolved for output.
+class framebuffer
+{
+public:
+	struct pixel
+	{
+		float sum[3];
+		uint32_t count;
+	};
+
+	static constexpr size_t line_size = cache_line_size;
+	static constexpr size_t pixels_per_line = line_size / sizeof(pixel);
+
+	framebuffer() = default;
+
+	framebuffer(int width, int height) { reset(width, height); }
+
+	// resize to width x height and clear every pixel
+	void reset(int width, int height)
+	{
+		w = width;
+		h = height;
+		stride = (size_t(width) + pixels_per_line - 1) / pixels_per_line * pixels_per_line;
+		size_t bytes = std::max<size_t>(stride * height * sizeof(pixel), line_size);
+		data = make_aligned_array<pixel>(bytes / sizeof(pixel));
+		std::fill(data.get(), data.get() + stride * height, pixel{{0, 0, 0}, 0});
+	}
+
+	int width() const { return w; }
+	int height() const { return h; }
+
+	pixel &at(int i, int j) { return data[j * stride + i]; }
+	const pixel &at(int i, int j) const { return data[j * stride + i]; }
+
+	// add 'count' samples whose colors sum to 'sum' to pixel (i, j)
+	void add(int i, int j, const color &sum, int count)
+	{
+		pixel &p = at(i, j);
+		p.sum[0] += float(sum.x());
+		p.sum[1] += float(sum.y());
+		p.sum[2] += float(sum.z());
+		p.count += count;
+	}
+
+	// the mean of pixel (i, j)'s samples, black if it has none
+	color average(int i, int j) const
+	{
+		const pixel &p = at(i, j);
+		if (p.count == 0)
+			return color(0, 0, 0);
+		return (1.0 / p.count) * color(p.sum[0], p.sum[1], p.sum[2]);
+	}
+
+	// the averaged image, for writing out
+	output_image resolve() const
+	{
+		output_image img(w, h);
+		for (int j = 0; j < h; j++)
+			for (int i = 0; i < w; i++)
+				img.set_pixel(i, j, average(i, j));
+		return img;
+	}
+
+private:
+	int w = 0, h = 0;
+	size_t stride = 0; // pixels per row, padded to whole cache lines
+	aligned_array<pixel> data;
+};
+
+// running mean and sum of squared deviations of one pixel's sample luminance
+struct pixel_variance
+{
+	double mean = 0, m2 = 0;
+
+	// Welford's update with the count'th sample
+	void add(double y, int count)
+	{
+		double delta = y - mean;
+		mean += delta / count;
+		m2 += delta * (y - mean);
+	}
+
+	// standard error of the mean luminance relative to the mean; dark pixels are measured
+	// against 1% of white instead, as relative noise there is invisible
+	double relative_error(int count) const
+	{
+		if (count < 2)
+			return infinity;
+		return sqrt(m2 / (count - 1) / count) / fmax(mean, 0.01);
+	}
+};
+
+#endif
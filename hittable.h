@@ -3,6 +3,7 @@
 
 #include "rtweekend.h"
 #include "aabb.h"
+#include "ray_packet.h"
 
 class material;
 
@@ -14,8 +15,10 @@ public:
 	vec3 normal;	 // 㴦ķ
 	double t;		 // 㴦tֵ
 	bool front_face; // Ƿ
-	std::shared_ptr<material> mat;
+	const material *mat; // not owning: material_table keeps the materials of primitives alive
 	double u, v; // texture coordinate
+	double uv_scale = 0;  // change of u, v per unit of length along the surface at p, set by the shape hit
+	double footprint = 0; // width of the ray's cone at p in texture coordinates, for filtered lookups
 
 	void set_face_normal(const ray &r, const vec3 &outward_normal)
 	{
@@ -36,6 +39,29 @@ public:
 
 	virtual aabb bounding_box() const = 0;
 
+	// Intersect the lanes of 'packet' selected by 'active'. For every lane that hits, fill in its
+	// record, shrink its t_max to the hit and set its bit in the returned mask. By default the
+	// lanes are traced one at a time, each with its own random stream swapped in (volumes sample
+	// while intersecting); primitives worth vectorizing override this.
+	virtual uint32_t hit_packet(ray_packet &packet, uint32_t active, hit_record *recs) const
+	{
+		uint32_t hits = 0;
+		for (int k = 0; k < packet.size; k++)
+		{
+			if (!(active & (1u << k)))
+				continue;
+
+			std::swap(thread_rng(), packet.rng[k]);
+			if (hit(packet.rays[k], interval(packet.t_min[k], packet.t_max[k]), recs[k]))
+			{
+				packet.t_max[k] = recs[k].t;
+				hits |= 1u << k;
+			}
+			std::swap(thread_rng(), packet.rng[k]);
+		}
+		return hits;
+	}
+
     virtual double pdf_value(const point3& origin, const vec3& direction) const {
         return 0.0;
     }
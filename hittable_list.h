@@ -43,6 +43,15 @@ public:
 		}
 		return hit_anything;
 	}
+
+	uint32_t hit_packet(ray_packet &packet, uint32_t active, hit_record *recs) const override
+	{
+		// each object only overwrites lanes it hits closer than the hits found so far
+		uint32_t hits = 0;
+		for (const auto &object : objects)
+			hits |= object->hit_packet(packet, active, recs);
+		return hits;
+	}
 	
 
 	double pdf_value(const point3& origin, const vec3& direction) const override {
@@ -0,0 +1,506 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A rendered frame in linear RGB, three floats per pixel, rows top to bottom. Writers of 8-bit
+// formats gamma-encode and quantize it on the way out; float formats store it as it is.
+struct output_image
+{
+	int width = 0, height = 0;
+	std::vector<float> pixels;
+
+	output_image() = default;
+
+	output_image(int width, int height) : width(width), height(height), pixels(size_t(width) * height * 3) {}
+
+	color pixel(int i, int j) const
+	{
+		const float *p = &pixels[(size_t(j) * width + i) * 3];
+		return color(p[0], p[1], p[2]);
+	}
+
+	void set_pixel(int i, int j, const color &c)
+	{
+		float *p = &pixels[(size_t(j) * width + i) * 3];
+		p[0] = float(c.x());
+		p[1] = float(c.y());
+		p[2] = float(c.z());
+	}
+
+	// the image as 8-bit RGB, rows top to bottom
+	std::vector<unsigned char> to_bytes() const
+	{
+		std::vector<unsigned char> bytes(size_t(width) * height * 3);
+		for (int j = 0; j < height; j++)
+			for (int i = 0; i < width; i++)
+				write_color(&bytes[(size_t(j) * width + i) * 3], pixel(i, j));
+		return bytes;
+	}
+};
+
+// encodes an output_image in one file format
+class image_writer
+{
+public:
+	virtual ~image_writer() = default;
+
+	virtual bool write(std::ostream &out, const output_image &img) const = 0;
+};
+
+// PPM, binary (P6) by default; the ASCII variant (P3) is three times the size and much slower
+// to write, but can be read by eye
+class ppm_writer : public image_writer
+{
+public:
+	explicit ppm_writer(bool ascii = false) : ascii(ascii) {}
+
+	bool write(std::ostream &out, const output_image &img) const override
+	{
+		std::vector<unsigned char> bytes = img.to_bytes();
+		out << (ascii ? "P3\n" : "P6\n") << img.width << ' ' << img.height << "\n255\n";
+		if (!ascii)
+			out.write(reinterpret_cast<const char *>(bytes.data()), std::streamsize(bytes.size()));
+		else
+			for (size_t k = 0; k < bytes.size(); k += 3)
+				out << int(bytes[k]) << ' ' << int(bytes[k + 1]) << ' ' << int(bytes[k + 2]) << '\n';
+		return bool(out);
+	}
+
+private:
+	bool ascii;
+};
+
+// Portable float map: linear 32-bit floats, unclamped, for compositing. The format stores rows
+// bottom to top; a negative scale in the header marks the floats as little-endian.
+class pfm_writer : public image_writer
+{
+public:
+	bool write(std::ostream &out, const output_image &img) const override
+	{
+		out << "PF\n" << img.width << ' ' << img.height << "\n-1.0\n";
+		std::vector<unsigned char> row(size_t(img.width) * 3 * 4);
+		for (int j = img.height - 1; j >= 0; j--)
+		{
+			const float *p = &img.pixels[size_t(j) * img.width * 3];
+			for (size_t k = 0; k < size_t(img.width) * 3; k++)
+			{
+				uint32_t bits;
+				std::memcpy(&bits, &p[k], 4);
+				for (int b = 0; b < 4; b++)
+					row[k * 4 + b] = (unsigned char)(bits >> (8 * b));
+			}
+			out.write(reinterpret_cast<const char *>(row.data()), std::streamsize(row.size()));
+		}
+		return bool(out);
+	}
+};
+
+// PNG, 8-bit RGB. Every row gets whichever of the five PNG filters leaves the smallest residuals,
+// then the image is deflated with LZ77 matching and deflate's fixed Huffman codes, which gets
+// most of what a full zlib would without building per-image code tables.
+class png_writer : public image_writer
+{
+public:
+	bool write(std::ostream &out, const output_image &img) const override
+	{
+		std::vector<unsigned char> filtered = filter_rows(img.to_bytes(), img.width, img.height);
+
+		std::vector<unsigned char> header;
+		put_u32(header, uint32_t(img.width));
+		put_u32(header, uint32_t(img.height));
+		header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bits per channel, RGB, no interlacing
+
+		static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+		out.write(reinterpret_cast<const char *>(signature), 8);
+		write_chunk(out, "IHDR", header);
+		write_chunk(out, "IDAT", zlib_compress(filtered));
+		write_chunk(out, "IEND", {});
+		return bool(out);
+	}
+
+private:
+	static void put_u32(std::vector<unsigned char> &out, uint32_t v)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+			out.push_back((unsigned char)(v >> shift));
+	}
+
+	static uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc)
+	{
+		// a plain array: the writer thread may still run during static destruction at exit
+		static const auto table = []
+		{
+			std::array<uint32_t, 256> t{};
+			for (uint32_t n = 0; n < 256; n++)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				t[n] = c;
+			}
+			return t;
+		}();
+		for (size_t k = 0; k < size; k++)
+			crc = table[(crc ^ data[k]) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+	static void write_chunk(std::ostream &out, const char *type, const std::vector<unsigned char> &data)
+	{
+		std::vector<unsigned char> bytes;
+		put_u32(bytes, uint32_t(data.size()));
+		bytes.insert(bytes.end(), type, type + 4);
+		bytes.insert(bytes.end(), data.begin(), data.end());
+		uint32_t crc = crc32(bytes.data() + 4, bytes.size() - 4, 0xffffffffu) ^ 0xffffffffu;
+		put_u32(bytes, crc);
+		out.write(reinterpret_cast<const char *>(bytes.data()), std::streamsize(bytes.size()));
+	}
+
+	static int paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		if (pa <= pb && pa <= pc)
+			return a;
+		return pb <= pc ? b : c;
+	}
+
+	// prefix every row with its filter type and replace its bytes by the filtered residuals
+	static std::vector<unsigned char> filter_rows(const std::vector<unsigned char> &bytes, int width, int height)
+	{
+		size_t stride = size_t(width) * 3;
+		std::vector<unsigned char> out;
+		out.reserve((stride + 1) * height);
+		std::vector<unsigned char> zero_row(stride, 0), candidate(stride), best(stride);
+
+		for (int j = 0; j < height; j++)
+		{
+			const unsigned char *row = &bytes[j * stride];
+			const unsigned char *up = j > 0 ? &bytes[(j - 1) * stride] : zero_row.data();
+			int best_type = 0;
+			uint64_t best_cost = UINT64_MAX;
+			for (int type = 0; type < 5; type++)
+			{
+				uint64_t cost = 0;
+				for (size_t k = 0; k < stride; k++)
+				{
+					int a = k >= 3 ? row[k - 3] : 0;
+					int b = up[k];
+					int c = k >= 3 ? up[k - 3] : 0;
+					int predicted = type == 0 ? 0 : type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : paeth(a, b, c);
+					candidate[k] = (unsigned char)(row[k] - predicted);
+					cost += std::abs(int(int8_t(candidate[k])));
+				}
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_type = type;
+					best.swap(candidate);
+				}
+			}
+			out.push_back((unsigned char)best_type);
+			out.insert(out.end(), best.begin(), best.end());
+		}
+		return out;
+	}
+
+	// appends bits to a byte stream least significant bit first, as deflate packs them
+	struct bit_writer
+	{
+		std::vector<unsigned char> &out;
+		uint32_t bits = 0;
+		int count = 0;
+
+		void put(uint32_t value, int n)
+		{
+			bits |= value << count;
+			count += n;
+			for (; count >= 8; count -= 8, bits >>= 8)
+				out.push_back((unsigned char)bits);
+		}
+
+		// Huffman codes are packed starting from their most significant bit
+		void put_code(uint32_t code, int n)
+		{
+			uint32_t reversed = 0;
+			for (int k = 0; k < n; k++)
+				reversed |= ((code >> k) & 1) << (n - 1 - k);
+			put(reversed, n);
+		}
+
+		void flush()
+		{
+			if (count > 0)
+				out.push_back((unsigned char)bits);
+			bits = 0;
+			count = 0;
+		}
+	};
+
+	// a literal/length symbol in deflate's fixed Huffman code
+	static void put_symbol(bit_writer &w, int symbol)
+	{
+		if (symbol < 144)
+			w.put_code(0x30 + symbol, 8);
+		else if (symbol < 256)
+			w.put_code(0x190 + symbol - 144, 9);
+		else if (symbol < 280)
+			w.put_code(symbol - 256, 7);
+		else
+			w.put_code(0xc0 + symbol - 280, 8);
+	}
+
+	static void put_match(bit_writer &w, int length, int distance)
+	{
+		static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+											35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+											 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+		static const int distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+											  193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+											  6145, 8193, 12289, 16385, 24577};
+		static const int distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+											   6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+		int l = 28;
+		while (length_base[l] > length)
+			l--;
+		put_symbol(w, 257 + l);
+		w.put(length - length_base[l], length_extra[l]);
+
+		int d = 29;
+		while (distance_base[d] > distance)
+			d--;
+		w.put_code(d, 5);
+		w.put(distance - distance_base[d], distance_extra[d]);
+	}
+
+	// zlib stream of one fixed-Huffman deflate block, with greedy LZ77 matching over hash chains
+	static std::vector<unsigned char> zlib_compress(const std::vector<unsigned char> &data)
+	{
+		const int window = 32768, max_match = 258, max_chain = 32;
+		const int hash_bits = 15;
+
+		std::vector<unsigned char> out = {0x78, 0x01};
+		bit_writer w{out};
+		w.put(1, 1); // last block
+		w.put(1, 2); // fixed Huffman codes
+
+		std::vector<int> head(size_t(1) << hash_bits, -1), prev(window, -1);
+		size_t n = data.size();
+		auto hash = [&](size_t p)
+		{
+			uint32_t v = uint32_t(data[p]) << 16 | uint32_t(data[p + 1]) << 8 | data[p + 2];
+			return (v * 2654435761u) >> (32 - hash_bits);
+		};
+		auto insert = [&](size_t p)
+		{
+			if (p + 3 > n)
+				return;
+			uint32_t h = hash(p);
+			prev[p & (window - 1)] = head[h];
+			head[h] = int(p);
+		};
+
+		size_t pos = 0;
+		while (pos < n)
+		{
+			int best_length = 0, best_distance = 0;
+			if (pos + 3 <= n)
+			{
+				int limit = int(std::min<size_t>(max_match, n - pos));
+				int candidate = head[hash(pos)];
+				for (int chain = 0; candidate >= 0 && int(pos) - candidate < window && chain < max_chain; chain++)
+				{
+					int length = 0;
+					while (length < limit && data[candidate + length] == data[pos + length])
+						length++;
+					if (length > best_length)
+					{
+						best_length = length;
+						best_distance = int(pos) - candidate;
+						if (length == limit)
+							break;
+					}
+					int next = prev[candidate & (window - 1)];
+					if (next >= candidate)
+						break;
+					candidate = next;
+				}
+			}
+
+			if (best_length >= 3)
+			{
+				put_match(w, best_length, best_distance);
+				for (int k = 0; k < best_length; k++)
+					insert(pos + k);
+				pos += best_length;
+			}
+			else
+			{
+				put_symbol(w, data[pos]);
+				insert(pos);
+				pos++;
+			}
+		}
+		put_symbol(w, 256); // end of block
+		w.flush();
+
+		uint32_t a = 1, b = 0;
+		for (unsigned char byte : data)
+		{
+			a = (a + byte) % 65521;
+			b = (b + a) % 65521;
+		}
+		put_u32(out, b << 16 | a);
+		return out;
+	}
+};
+
+// The writer for a format: "ppm" (binary), "ppm-ascii", "pfm" or "png". nullptr if unknown.
+inline std::unique_ptr<image_writer> make_image_writer(const std::string &format)
+{
+	if (format == "ppm")
+		return std::make_unique<ppm_writer>();
+	if (format == "ppm-ascii")
+		return std::make_unique<ppm_writer>(true);
+	if (format == "pfm")
+		return std::make_unique<pfm_writer>();
+	if (format == "png")
+		return std::make_unique<png_writer>();
+	return nullptr;
+}
+
+// the format named by the extension of path, lower-cased; "ppm" if it has none
+inline std::string format_from_path(const std::string &path)
+{
+	size_t dot = path.find_last_of("./\\");
+	if (dot == std::string::npos || path[dot] != '.')
+		return "ppm";
+	std::string format = path.substr(dot + 1);
+	for (char &c : format)
+		c = char(std::tolower((unsigned char)c));
+	return format;
+}
+
+// Encodes and writes images on a background thread, so that writing out one frame overlaps with
+// rendering the next. Images are written in the order they were queued.
+class image_output
+{
+public:
+	~image_output()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		if (worker.joinable())
+			worker.join();
+	}
+
+	// queue img to be written to path; an empty format picks it by the extension of path
+	void write(output_image img, const std::string &path, const std::string &format = "")
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job{std::move(img), path, format.empty() ? format_from_path(path) : format});
+		if (!worker.joinable())
+			worker = std::thread([this] { run(); });
+		wake.notify_one();
+	}
+
+	// Block until every queued image has been written. Returns false if any image queued since
+	// the last wait() could not be written.
+	bool wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return jobs.empty() && !busy; });
+		bool written = !failed;
+		failed = false;
+		return written;
+	}
+
+private:
+	struct job
+	{
+		output_image img;
+		std::string path, format;
+	};
+
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	std::deque<job> jobs;
+	bool busy = false, stopping = false, failed = false;
+	std::thread worker;
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+			job next = std::move(jobs.front());
+			jobs.pop_front();
+			busy = true;
+
+			lock.unlock();
+			bool written = write_file(next);
+			lock.lock();
+
+			failed = failed || !written;
+			busy = false;
+			idle.notify_all();
+		}
+	}
+
+	static bool write_file(const job &j)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::unique_ptr<image_writer> writer = make_image_writer(j.format);
+		if (!writer)
+		{
+			std::cerr << "ERROR: Unknown image format '" << j.format << "' for '" << j.path << "'.\n";
+			return false;
+		}
+		std::ofstream out(j.path, std::ios::binary);
+		bool written = out && writer->write(out, j.img);
+		out.close(); // a full disk may only show when the last bytes are flushed
+		if (!written || !out)
+		{
+			std::cerr << "ERROR: Could not write the image to '" << j.path << "'.\n";
+			return false;
+		}
+		std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+		std::clog << "wrote " << j.path << " (" << j.format << ") in " << seconds.count() << " s\n";
+		return true;
+	}
+};
+
+// The process-wide output queue. It is destroyed at exit, after waiting for the images still queued.
+inline image_output &background_output()
+{
+	static image_output output;
+	return output;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+#include "affine.h"
+#include "hittable.h"
+
+// One placement of a shared object under an affine map. The object, typically a bvh_node or a
+// triangle_mesh, is the bottom level: it stays in its own space and any number of instances
+// refer to it, so a thousand copies cost one copy of the geometry. A bvh_node over instances is
+// the top level. Unlike a translate(rotate_y(...)) chain, an instance takes any affine map and
+// moves the ray into object space once, with one virtual call.
+class instance : public hittable
+{
+public:
+	instance(shared_ptr<hittable> object, const affine3 &object_to_world)
+		: object(std::move(object)), to_world(object_to_world), to_object(object_to_world.inverse())
+	{
+		double scale;
+		rigid = to_world.is_similarity(scale) && fabs(scale - 1) < 1e-9;
+		// lengths grow by the cube root of the volume change, on average over directions
+		uv_factor = 1 / std::cbrt(fabs(to_world.determinant()));
+		bbox = to_world.bounds(this->object->bounding_box());
+	}
+
+	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+	{
+		// the object-space direction isn't normalized, so distances along both rays agree
+		ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+		if (!object->hit(object_r, ray_t, rec))
+			return false;
+
+		rec.p = r.at(rec.t);
+		// a rigid map turns normals like any vector; others need the inverse transpose, which
+		// keeps the normal on the same side of the surface as the ray but not of unit length
+		rec.normal = rigid ? to_world.vector(rec.normal) : unit_vector(to_object.transposed_vector(rec.normal));
+		rec.uv_scale *= uv_factor;
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// sampling an instanced light; densities are per solid angle, which only rigid maps preserve
+	double pdf_value(const point3 &origin, const vec3 &direction) const override
+	{
+		return object->pdf_value(to_object.point(origin), to_object.vector(direction));
+	}
+
+	vec3 random(const point3 &origin) const override
+	{
+		return to_world.vector(object->random(to_object.point(origin)));
+	}
+
+	const affine3 &transform() const { return to_world; }
+
+private:
+	shared_ptr<hittable> object;
+	affine3 to_world, to_object;
+	bool rigid;
+	double uv_factor; // 1 / how much the map stretches lengths, on average
+	aabb bbox;
+};
+
+#endif
@@ -6,9 +6,31 @@
 #include "material.h"
 #include "bvh.h"
 #include "constant_medium.h"
+#include "instance.h"
+#include "scene.h"
+#include "scene_cache.h"
 
+#include <chrono>
+#include <functional>
+#include <string>
 #include <time.h>
 
+// when the process started, which is what a user waiting for the first pixel measures from
+static const auto program_start = std::chrono::steady_clock::now();
+
+// Wait for the textures still loading in the background, then report how startup went. Called
+// right before each render, built-in scene or scene file, so the time to the first pixel covers
+// everything before it.
+void report_startup()
+{
+	texture_cache &textures = texture_cache::global();
+	double texture_wait = textures.wait_for_loads();
+	std::clog << "startup: ";
+	textures.report_loading(std::clog);
+	std::clog << ", " << texture_wait << " s waited for after the geometry; first pixel after "
+			  << std::chrono::duration<double>(std::chrono::steady_clock::now() - program_start).count() << " s\n";
+}
+
 void bounsing_shperes()
 {
 	// World
@@ -364,7 +386,7 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
 	auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
 	world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-	auto pertext = make_shared<noise_texture>(0.2);
+	auto pertext = make_shared<noise_texture>(0.2, 7);
 	world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
 
 	hittable_list boxes2;
@@ -374,12 +396,13 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 		boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
 	}
 
-	world.add(make_shared<translate>(
-		make_shared<rotate_y>(
-			make_shared<bvh_node>(boxes2), 15),
-		vec3(-100, 270, 395)
-	)
-	);
+	world.add(make_shared<instance>(
+		make_shared<bvh_node>(boxes2),
+		affine3::translation(vec3(-100, 270, 395)) * affine3::rotation_y(15)
+	));
+
+	// a top-level BVH over the box field, the instance and the loose shapes
+	world = hittable_list(make_shared<bvh_node>(world));
 
 	camera cam;
 
@@ -399,47 +422,49 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 	//cam.render(world);
 }
 
-void fun() {
-	hittable_list world;
-
+// The fun() Cornell scene. 'add' puts each top-level object into the world, with the material
+// it is made of.
+void fun_scene(const std::function<void(shared_ptr<hittable>, shared_ptr<material>)> &add, hittable_list &lights)
+{
 	auto red = make_shared<lambertian>(color(.65, .05, .05));
 	auto white = make_shared<lambertian>(color(.73, .73, .73));
 	auto green = make_shared<lambertian>(color(.12, .45, .15));
 	auto light = make_shared<diffuse_light>(color(15, 15, 15));
 
 	// Cornell box sides
-	world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), green));
-	world.add(make_shared<quad>(point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), red));
-	world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), white));
-	world.add(make_shared<quad>(point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), white));
+	add(make_shared<quad>(point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), green), green);
+	add(make_shared<quad>(point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), red), red);
+	add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white), white);
+	add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), white), white);
+	add(make_shared<quad>(point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), white), white);
 
 	// Light
-	world.add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
+	add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light), light);
 
 	// Box
 	shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
 	box1 = make_shared<rotate_y>(box1, 15);
 	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-	world.add(box1);
+	add(box1, white);
 
 	// Glass Sphere
 	auto glass = make_shared<dielectric>(1.5);
-	world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+	add(make_shared<sphere>(point3(190, 90, 190), 90, glass), glass);
 
 	// Light Sources
-	hittable_list lights;
 	auto m = shared_ptr<material>();
 	lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), m));
 	lights.add(make_shared<sphere>(point3(190, 90, 190), 90, m));
+}
 
-	camera cam;
-
+void fun_camera(camera &cam, int image_width, int samples_per_pixel, int num_threads)
+{
 	cam.aspect_ratio = 1.0;
-	cam.image_width = 600;
-	cam.samples_per_pixel = 1000;
+	cam.image_width = image_width;
+	cam.samples_per_pixel = samples_per_pixel;
 	cam.max_depth = 50;
 	cam.background = color(0, 0, 0);
+	cam.num_threads = num_threads;
 
 	cam.vfov = 40;
 	cam.lookfrom = point3(278, 278, -800);
@@ -447,12 +472,295 @@ void fun() {
 	cam.vup = vec3(0, 1, 0);
 
 	cam.defocus_angle = 0;
+}
+
+void fun(int image_width = 600, int samples_per_pixel = 1000, int num_threads = 0) {
+	hittable_list world;
+	hittable_list lights;
+	fun_scene([&](shared_ptr<hittable> object, shared_ptr<material>) { world.add(object); }, lights);
 
+	camera cam;
+	fun_camera(cam, image_width, samples_per_pixel, num_threads);
+
+	report_startup();
 	cam.render(world,lights);
 }
 
-int main()
+// An object that, when refcounted, does on every hit what the hit path did while hit records
+// held a shared_ptr to the material: the primitive copied its shared_ptr into the record, and
+// hittable_list copied the record again, each an atomic increment and decrement of the
+// material's refcount.
+class refcounted_hits : public hittable
+{
+public:
+	refcounted_hits(shared_ptr<hittable> object, shared_ptr<material> mat, bool refcounted)
+		: object(object), mat(mat), refcounted(refcounted) {}
+
+	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+	{
+		if (!object->hit(r, ray_t, rec))
+			return false;
+		if (refcounted)
+		{
+			thread_local shared_ptr<material> record, copy;
+			record = mat;
+			copy = record;
+		}
+		return true;
+	}
+
+	aabb bounding_box() const override { return object->bounding_box(); }
+
+private:
+	shared_ptr<hittable> object;
+	shared_ptr<material> mat;
+	bool refcounted;
+};
+
+// The fun() Cornell scene on 50 threads, many more than cores, so that any cache line written
+// on the hit path keeps moving between cores: once with the refcount traffic of shared_ptr
+// materials in hit records, once without. Both wrap the objects alike, and render the same image.
+void fun_benchmark()
+{
+	for (bool refcounted : {true, false})
+	{
+		hittable_list world;
+		hittable_list lights;
+		fun_scene([&](shared_ptr<hittable> object, shared_ptr<material> mat)
+				  { world.add(make_shared<refcounted_hits>(object, mat, refcounted)); }, lights);
+
+		camera cam;
+		fun_camera(cam, 300, 100, 50);
+		cam.output_path = refcounted ? "fun_shared_ptr.ppm" : "fun_table.ppm";
+
+		auto start = std::chrono::steady_clock::now();
+		cam.render(world, lights);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "fun() at 300x300, 100 spp on 50 threads, "
+				  << (refcounted ? "shared_ptr materials: " : "material table: ") << seconds << "s\n";
+	}
+}
+
+// the slab test as aabb::hit did it before rays cached their inverse direction:
+// three divisions per call and a branch per axis
+bool box_hit_reference(const aabb &box, const ray &r, interval ray_t)
+{
+	const point3 &orig = r.origin();
+	const vec3 &dir = r.direction();
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const interval &ax = box.axis_interval(axis);
+		const double adinv = 1.0 / dir[axis];
+
+		auto t0 = (ax.min - orig[axis]) * adinv;
+		auto t1 = (ax.max - orig[axis]) * adinv;
+
+		if (t0 < t1)
+		{
+			if (t0 > ray_t.min)
+				ray_t.min = t0;
+			if (t1 < ray_t.max)
+				ray_t.max = t1;
+		}
+		else
+		{
+			if (t1 > ray_t.min)
+				ray_t.min = t1;
+			if (t0 < ray_t.max)
+				ray_t.max = t0;
+		}
+
+		if (ray_t.min >= ray_t.max)
+			return false;
+	}
+	return true;
+}
+
+// microbenchmark: every ray against every box, with the old and the current box test
+void box_hit_benchmark()
+{
+	const int box_count = 1024;
+	const int ray_count = 4096;
+
+	std::vector<aabb> boxes;
+	for (int i = 0; i < box_count; i++)
+	{
+		auto p = point3::random(-10, 10);
+		boxes.push_back(aabb(p, p + vec3::random(0.1, 4)));
+	}
+
+	// a quarter of the rays are axis-aligned, the case that produces infinities and NaNs
+	std::vector<ray> rays;
+	for (int i = 0; i < ray_count; i++)
+	{
+		auto dir = vec3::random(-1, 1);
+		if (i % 4 == 0)
+			dir[i % 3] = 0;
+		rays.push_back(ray(point3::random(-15, 15), dir));
+	}
+
+	auto run = [&](const char *name, auto &&test)
+	{
+		auto start = std::chrono::steady_clock::now();
+		long long hits = 0;
+		// rays innermost, so the old test's divisions can't be hoisted out of the loop
+		for (const auto &box : boxes)
+			for (const auto &r : rays)
+				hits += test(box, r, interval(0.001, infinity));
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << name << ": " << (double(box_count) * ray_count / seconds) / 1e6 << " Mtests/s, "
+				  << hits << " hits\n";
+	};
+
+	run("reference aabb test (1/dir per test)", box_hit_reference);
+	run("aabb::hit (cached 1/dir, branchless)", [](const aabb &box, const ray &r, interval t) { return box.hit(r, t); });
+}
+
+// microbenchmark: noise and 7-octave turbulence at random points, with the scalar and the SIMD kernel
+void noise_benchmark()
+{
+	const int point_count = 1 << 16;
+	const int rounds = 16;
+
+	std::vector<point3> points;
+	for (int i = 0; i < point_count; i++)
+		points.push_back(point3::random(-100, 100));
+
+	perlin noise;
+	auto run = [&](const std::string &name, int octaves, auto &&eval)
+	{
+		auto start = std::chrono::steady_clock::now();
+		double sum = 0;
+		for (int r = 0; r < rounds; r++)
+			for (const auto &p : points)
+				sum += eval(p);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << name << ": " << (double(point_count) * rounds * octaves / seconds) / 1e6
+				  << " M noise evaluations/s, sum " << sum << "\n";
+	};
+
+	for (bool simd : {false, true})
+	{
+		noise.set_simd(simd);
+		std::string kernel = noise.kernel_name();
+		run(kernel + " noise", 1, [&](const point3 &p) { return noise.noise(p); });
+		run(kernel + " turb, 7 octaves", 7, [&](const point3 &p) { return noise.turb(p, 7); });
+	}
+}
+
+// main --benchmark NAME
+// runs one of the benchmarks above: boxes, fun or noise
+int run_benchmark(const std::string &name)
 {
+	if (name == "boxes")
+		box_hit_benchmark();
+	else if (name == "fun")
+		fun_benchmark();
+	else if (name == "noise")
+		noise_benchmark();
+	else
+	{
+		std::cerr << "ERROR: Unknown benchmark '" << name << "', expected boxes, fun or noise.\n";
+		return 1;
+	}
+	return 0;
+}
+
+// main SCENE [-o OUTPUT] [--spp N] [--width W] [--height H] [--threads N] [--cache FILE] [--texture-budget MB] [--checkpoint FILE]
+// renders a scene file, the options overriding what it sets
+int render_scene_file(int argc, char *argv[])
+{
+	std::string scene_path, output_path, cache_path, checkpoint_path;
+	int spp = 0, width = 0, height = 0, threads = -1;
+	for (int k = 1; k < argc; k++)
+	{
+		std::string arg = argv[k];
+		bool has_value = k + 1 < argc;
+		if ((arg == "-o" || arg == "--output") && has_value)
+			output_path = argv[++k];
+		else if (arg == "--spp" && has_value)
+			spp = std::atoi(argv[++k]);
+		else if (arg == "--width" && has_value)
+			width = std::atoi(argv[++k]);
+		else if (arg == "--height" && has_value)
+			height = std::atoi(argv[++k]);
+		else if (arg == "--threads" && has_value)
+			threads = std::atoi(argv[++k]);
+		else if (arg == "--cache" && has_value)
+			cache_path = argv[++k];
+		else if (arg == "--checkpoint" && has_value)
+			checkpoint_path = argv[++k];
+		else if (arg == "--texture-budget" && has_value)
+			texture_cache::global().set_budget(size_t(std::atof(argv[++k]) * (1 << 20)));
+		else if (arg[0] != '-' && scene_path.empty())
+			scene_path = arg;
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " SCENE [-o OUTPUT] [--spp N] [--width W] [--height H] [--threads N] [--cache FILE] [--texture-budget MB] [--checkpoint FILE]\n"
+					  << "       " << argv[0] << " --benchmark boxes|fun|noise\n";
+			return 1;
+		}
+	}
+
+	scene s;
+	if (!cache_path.empty())
+	{
+		double cache_seconds;
+		bool cache_hit;
+		if (!load_scene_cached(scene_path, cache_path, s, cache_seconds, cache_hit))
+			return 1;
+		if (!cache_hit)
+			std::clog << "parsed " << scene_path << " in " << s.parse_seconds << " s, built and wrote the cache "
+					  << cache_path << " in " << s.bvh_seconds << " s\n";
+		std::clog << "mapped the cache " << cache_path << " (" << s.shape_count << " primitives) in "
+				  << cache_seconds * 1000 << " ms\n";
+	}
+	else
+	{
+		if (!load_scene(scene_path, s))
+			return 1;
+		std::clog << "parsed " << scene_path << " (" << s.shape_count << " shapes) in " << s.parse_seconds
+				  << " s, built its BVHs in " << s.bvh_seconds << " s\n";
+	}
+
+	camera &cam = s.cam;
+	if (!output_path.empty())
+		cam.output_path = output_path;
+	if (spp > 0)
+		cam.samples_per_pixel = spp;
+	if (width > 0)
+		cam.image_width = width;
+	if (height > 0)
+	{
+		// the camera derives its height from the aspect ratio, rounding down
+		cam.aspect_ratio = double(cam.image_width) / height;
+		while (int(cam.image_width / cam.aspect_ratio) < height)
+			cam.aspect_ratio = std::nextafter(cam.aspect_ratio, 0.0);
+	}
+	if (threads >= 0)
+		cam.num_threads = threads;
+	if (!checkpoint_path.empty())
+		cam.checkpoint_path = checkpoint_path;
+	if (!cam.can_write_output())
+		return 1;
+
+	// textures were decoding in the background since the parser named them
+	report_startup();
+	s.render();
+	texture_cache::global().report(std::clog);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && std::string(argv[1]) == "--benchmark")
+		return run_benchmark(argv[2]);
+	if (argc > 1)
+		return render_scene_file(argc, argv);
+
 	clock_t start, end;
 	start = clock();
 
@@ -489,6 +797,15 @@ int main()
 
 	case 11: fun();
 		break;
+	case 12:
+		box_hit_benchmark();
+		break;
+	case 13:
+		fun_benchmark();
+		break;
+	case 14:
+		noise_benchmark();
+		break;
 	}
 
 	end = clock();
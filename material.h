@@ -4,15 +4,29 @@
 #include "rtweekend.h"
 #include "hittable_list.h"
 #include "texture.h"
+#include "texture_program.h"
 #include "onb.h"
 #include "pdf.h"
 
+#include <variant>
+
 class scatter_record {
 public:
 	color attenuation;
-	shared_ptr<pdf> pdf_ptr;
+	// the pdf the scattered direction is drawn from, stored in place so that scattering never
+	// allocates; left empty by materials that choose the ray themselves (skip_pdf)
+	std::variant<std::monostate, cosine_pdf, sphere_pdf> scatter_pdf;
 	bool skip_pdf;
 	ray skip_pdf_ray;
+
+	// the pdf held in scatter_pdf, nullptr if there is none
+	const pdf* pdf_ptr() const {
+		if (auto p = std::get_if<cosine_pdf>(&scatter_pdf))
+			return p;
+		if (auto p = std::get_if<sphere_pdf>(&scatter_pdf))
+			return p;
+		return nullptr;
+	}
 };
 
 class material
@@ -42,11 +56,11 @@ class lambertian : public material
 public:
 	lambertian(const color &albedo) : tex(make_shared<solid_color>(albedo)) {}
 
-	lambertian(shared_ptr<texture> tex) : tex(tex) {}
+	lambertian(shared_ptr<texture> tex) : tex(texture_program::compile(tex)) {}
 
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
-		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-		srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+		srec.attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
+		srec.scatter_pdf.emplace<cosine_pdf>(rec.normal);
 		srec.skip_pdf = false;
 		return true;
 	}
@@ -72,7 +86,7 @@ public:
 		reflected = unit_vector(reflected) + fuzz * (random_unit_vec());
 
 		srec.attenuation = albedo;
-		srec.pdf_ptr = nullptr;
+		srec.scatter_pdf = std::monostate();
 		srec.skip_pdf = true;
 		srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
 
@@ -92,7 +106,7 @@ public:
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 	{
 		srec.attenuation = color(1.0, 1.0, 1.0);
-		srec.pdf_ptr = nullptr;
+		srec.scatter_pdf = std::monostate();
 		srec.skip_pdf = true;
 		double ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
 
@@ -130,7 +144,7 @@ private:
 class diffuse_light : public material
 {
 public:
-	diffuse_light(shared_ptr<texture> tex) : emit(tex) {}
+	diffuse_light(shared_ptr<texture> tex) : emit(texture_program::compile(tex)) {}
 
 	diffuse_light(const color &emit) : emit(make_shared<solid_color>(emit)) {}
 
@@ -138,7 +152,7 @@ public:
 		const override {
 		if (!rec.front_face)
 			return color(0, 0, 0);
-		return emit->value(u, v, p);
+		return emit->value(u, v, p, rec.footprint);
 	}
 
 private:
@@ -148,11 +162,11 @@ private:
 class isotropic : public material {
 public:
 	isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-	isotropic(shared_ptr<texture> tex) : tex(tex) {}
+	isotropic(shared_ptr<texture> tex) : tex(texture_program::compile(tex)) {}
 
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
-		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-		srec.pdf_ptr = make_shared<sphere_pdf>();
+		srec.attenuation = tex->value(rec.u, rec.v, rec.p, rec.footprint);
+		srec.scatter_pdf.emplace<sphere_pdf>();
 		srec.skip_pdf = false;
 		return true;
 	}
@@ -0,0 +1,45 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "rtweekend.h"
+
+#include <mutex>
+#include <unordered_map>
+
+class material;
+
+// Owns the materials of the scenes built from primitives, which keep only a plain pointer, as
+// their hit records do: recording or copying a hit touches no refcount shared between render
+// threads. Materials stay in the table until exit. Scene caches own theirs in flat_scene.
+class material_table
+{
+public:
+	static material_table &global()
+	{
+		static material_table table;
+		return table;
+	}
+
+	// keep mat alive and return it as the pointer primitives hold; null stays null
+	const material *add(shared_ptr<material> mat)
+	{
+		const material *handle = mat.get();
+		if (!handle)
+			return nullptr;
+		std::lock_guard<std::mutex> guard(mutex);
+		materials.emplace(handle, std::move(mat));
+		return handle;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		return materials.size();
+	}
+
+private:
+	std::mutex mutex;
+	std::unordered_map<const material *, shared_ptr<material>> materials;
+};
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Loaders for Wavefront OBJ and PLY meshes. Both stream the file, a line or an element at a time,
+// straight into mesh_data's arrays; polygons are split into triangle fans. Errors are reported to
+// std::cerr as the scene parser reports them.
+namespace mesh_loader
+{
+	inline bool error(const std::string &path, const std::string &what)
+	{
+		std::cerr << "ERROR: " << path << ": " << what << "\n";
+		return false;
+	}
+
+	// the next whitespace-separated word of line from k on, empty at the end
+	inline std::string_view next_word(std::string_view line, size_t &k)
+	{
+		while (k < line.size() && std::isspace((unsigned char)line[k]))
+			k++;
+		size_t begin = k;
+		while (k < line.size() && !std::isspace((unsigned char)line[k]))
+			k++;
+		return line.substr(begin, k - begin);
+	}
+
+	// a value of type T stored at bytes in the native byte order
+	template <typename T>
+	double decode(const unsigned char *bytes)
+	{
+		T v;
+		std::memcpy(&v, bytes, sizeof v);
+		return double(v);
+	}
+
+	template <typename T>
+	bool parse(std::string_view w, T &v)
+	{
+		auto [end, ec] = std::from_chars(w.data(), w.data() + w.size(), v);
+		return ec == std::errc() && end == w.data() + w.size();
+	}
+}
+
+// Load the OBJ file at path. Faces may mix the v, v/vt, v//vn and v/vt/vn forms and use negative
+// (relative) indices. OBJ indexes positions, texture coordinates and normals separately, so
+// every distinct combination a face uses becomes one mesh vertex. Normals and texture
+// coordinates are kept only if every face vertex has them. Groups, objects and materials are
+// ignored: the mesh takes the material it is given.
+inline bool load_obj(const std::string &path, mesh_data &out)
+{
+	using namespace mesh_loader;
+	std::ifstream in(path);
+	if (!in)
+		return error(path, "could not open the mesh");
+
+	std::vector<float> positions, uvs, normals; // as read, 3, 2 and 3 floats per entry
+	struct corner
+	{
+		int64_t v, t, n; // 0-based, -1 if absent
+	};
+	struct corner_hash
+	{
+		size_t operator()(const corner &c) const { return size_t(mix_bits(uint64_t(c.v) ^ mix_bits(uint64_t(c.t) ^ mix_bits(uint64_t(c.n))))); }
+	};
+	struct corner_equal
+	{
+		bool operator()(const corner &a, const corner &b) const { return a.v == b.v && a.t == b.t && a.n == b.n; }
+	};
+	std::unordered_map<corner, uint32_t, corner_hash, corner_equal> vertex_of;
+	std::vector<corner> corners; // of every mesh vertex
+	bool all_uvs = true, all_normals = true;
+
+	// resolve a 1-based or negative OBJ index into a list of 'count' entries
+	auto resolve = [](std::string_view w, size_t count, int64_t &index)
+	{
+		if (w.empty())
+		{
+			index = -1;
+			return true;
+		}
+		int64_t i;
+		if (!parse(w, i) || i == 0)
+			return false;
+		index = i > 0 ? i - 1 : int64_t(count) + i;
+		return index >= 0 && index < int64_t(count);
+	};
+
+	std::string line;
+	int line_number = 0;
+	std::vector<uint32_t> face;
+	while (std::getline(in, line))
+	{
+		line_number++;
+		std::string_view rest(line);
+		size_t k = 0;
+		std::string_view keyword = next_word(rest, k);
+		auto fail = [&](const char *what)
+		{ return error(path + ":" + std::to_string(line_number), what); };
+
+		if (keyword == "v" || keyword == "vn" || keyword == "vt")
+		{
+			std::vector<float> &list = keyword == "v" ? positions : keyword == "vn" ? normals : uvs;
+			int n = keyword == "vt" ? 2 : 3;
+			for (int c = 0; c < n; c++)
+			{
+				float value;
+				std::string_view w = next_word(rest, k);
+				if (keyword == "vt" && c == 1 && w.empty())
+					value = 0; // v is optional
+				else if (!parse(w, value))
+					return fail("expected a number");
+				list.push_back(value);
+			}
+		}
+		else if (keyword == "f")
+		{
+			face.clear();
+			for (std::string_view w = next_word(rest, k); !w.empty(); w = next_word(rest, k))
+			{
+				size_t slash1 = w.find('/');
+				size_t slash2 = slash1 == std::string_view::npos ? slash1 : w.find('/', slash1 + 1);
+				std::string_view vw = w.substr(0, slash1), tw, nw;
+				if (slash1 != std::string_view::npos)
+				{
+					tw = w.substr(slash1 + 1, slash2 == std::string_view::npos ? std::string_view::npos : slash2 - slash1 - 1);
+					if (slash2 != std::string_view::npos)
+						nw = w.substr(slash2 + 1);
+				}
+
+				corner c;
+				if (vw.empty() || !resolve(vw, positions.size() / 3, c.v) || !resolve(tw, uvs.size() / 2, c.t) ||
+					!resolve(nw, normals.size() / 3, c.n))
+					return fail("bad face vertex");
+				all_uvs = all_uvs && c.t >= 0;
+				all_normals = all_normals && c.n >= 0;
+
+				auto [it, added] = vertex_of.emplace(c, uint32_t(corners.size()));
+				if (added)
+					corners.push_back(c);
+				face.push_back(it->second);
+			}
+			if (face.size() < 3)
+				return fail("a face needs three vertices");
+			for (size_t i = 1; i + 1 < face.size(); i++)
+				out.indices.insert(out.indices.end(), {face[0], face[i], face[i + 1]});
+		}
+	}
+
+	vertex_of.clear();
+	for (const corner &c : corners)
+	{
+		out.x.push_back(positions[3 * c.v]);
+		out.y.push_back(positions[3 * c.v + 1]);
+		out.z.push_back(positions[3 * c.v + 2]);
+		if (all_normals)
+		{
+			out.nx.push_back(normals[3 * c.n]);
+			out.ny.push_back(normals[3 * c.n + 1]);
+			out.nz.push_back(normals[3 * c.n + 2]);
+		}
+		if (all_uvs)
+		{
+			out.tu.push_back(uvs[2 * c.t]);
+			out.tv.push_back(uvs[2 * c.t + 1]);
+		}
+	}
+	if (out.indices.empty())
+		return error(path, "the mesh has no faces");
+	return true;
+}
+
+// Load the PLY file at path, in the ascii, binary_little_endian or binary_big_endian format.
+// Vertices may carry x y z, nx ny nz and u v (or s t, texture_u texture_v); faces are read from
+// their vertex_indices (or vertex_index) list. Other elements and properties are skipped.
+inline bool load_ply(const std::string &path, mesh_data &out)
+{
+	using namespace mesh_loader;
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return error(path, "could not open the mesh");
+
+	enum format_t
+	{
+		ascii,
+		little_endian,
+		big_endian
+	} format = ascii;
+	struct property
+	{
+		std::string name;
+		int size = 0;		 // bytes of a value
+		char type = 'f';	 // 'i' signed, 'u' unsigned or 'f' floating point
+		int count_size = 0;	 // for lists, the bytes of the length
+		char count_type = 0; // ... and its type, 0 for plain properties
+	};
+	struct element
+	{
+		std::string name;
+		size_t count = 0;
+		std::vector<property> properties;
+	};
+	std::vector<element> elements;
+
+	auto type_of = [](std::string_view t, int &size, char &type)
+	{
+		static const struct
+		{
+			const char *name;
+			int size;
+			char type;
+		} types[] = {
+			{"char", 1, 'i'}, {"int8", 1, 'i'}, {"uchar", 1, 'u'}, {"uint8", 1, 'u'},
+			{"short", 2, 'i'}, {"int16", 2, 'i'}, {"ushort", 2, 'u'}, {"uint16", 2, 'u'},
+			{"int", 4, 'i'}, {"int32", 4, 'i'}, {"uint", 4, 'u'}, {"uint32", 4, 'u'},
+			{"float", 4, 'f'}, {"float32", 4, 'f'}, {"double", 8, 'f'}, {"float64", 8, 'f'}};
+		for (const auto &entry : types)
+		{
+			if (t == entry.name)
+			{
+				size = entry.size;
+				type = entry.type;
+				return true;
+			}
+		}
+		return false;
+	};
+
+	std::string line;
+	if (!std::getline(in, line) || line.substr(0, 3) != "ply")
+		return error(path, "not a PLY file");
+	while (true)
+	{
+		if (!std::getline(in, line))
+			return error(path, "the header has no end_header");
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		size_t k = 0;
+		std::string_view keyword = next_word(line, k);
+		if (keyword == "end_header")
+			break;
+		if (keyword == "format")
+		{
+			std::string_view f = next_word(line, k);
+			if (f == "ascii")
+				format = ascii;
+			else if (f == "binary_little_endian")
+				format = little_endian;
+			else if (f == "binary_big_endian")
+				format = big_endian;
+			else
+				return error(path, "unknown format '" + std::string(f) + "'");
+		}
+		else if (keyword == "element")
+		{
+			element e;
+			e.name = std::string(next_word(line, k));
+			if (!parse(next_word(line, k), e.count))
+				return error(path, "bad element count");
+			elements.push_back(e);
+		}
+		else if (keyword == "property")
+		{
+			if (elements.empty())
+				return error(path, "property outside of an element");
+			property p;
+			std::string_view t = next_word(line, k);
+			if (t == "list")
+			{
+				if (!type_of(next_word(line, k), p.count_size, p.count_type))
+					return error(path, "bad list length type");
+				t = next_word(line, k);
+			}
+			if (!type_of(t, p.size, p.type))
+				return error(path, "unknown property type '" + std::string(t) + "'");
+			p.name = std::string(next_word(line, k));
+			elements.back().properties.push_back(p);
+		}
+	}
+
+	// Every row takes at least a byte per value in ASCII, and its plain values and list lengths in
+	// binary, so counts the rest of the file can't hold are refused before anything is reserved.
+	std::streampos data_start = in.tellg();
+	in.seekg(0, std::ios::end);
+	uint64_t data_bytes = uint64_t(in.tellg() - data_start);
+	in.seekg(data_start);
+	for (const element &e : elements)
+	{
+		uint64_t row_bytes = 0;
+		for (const property &p : e.properties)
+			row_bytes += format == ascii ? 1 : p.count_type ? p.count_size : p.size;
+		if (row_bytes > 0 && e.count > data_bytes / row_bytes)
+			return error(path, "the header promises more " + e.name + " elements than the file holds");
+		data_bytes -= e.count * row_bytes;
+	}
+
+	// read one value of the given size and type; binary files are taken to be in the byte order
+	// of a little-endian machine unless they say otherwise
+	bool reverse_bytes = format == big_endian;
+	auto value = [&](int size, char type, double &v)
+	{
+		if (format == ascii)
+			return bool(in >> v);
+		unsigned char bytes[8];
+		if (!in.read(reinterpret_cast<char *>(bytes), size))
+			return false;
+		if (reverse_bytes)
+			std::reverse(bytes, bytes + size);
+		if (type == 'f')
+			v = size == 4 ? decode<float>(bytes) : decode<double>(bytes);
+		else if (type == 'i')
+			v = size == 1 ? decode<int8_t>(bytes) : size == 2 ? decode<int16_t>(bytes) : decode<int32_t>(bytes);
+		else
+			v = size == 1 ? decode<uint8_t>(bytes) : size == 2 ? decode<uint16_t>(bytes) : decode<uint32_t>(bytes);
+		return true;
+	};
+
+	std::vector<uint32_t> face;
+	for (const element &e : elements)
+	{
+		bool vertices = e.name == "vertex", faces = e.name == "face";
+		// where each vertex property goes, if anywhere
+		std::vector<std::vector<float> *> targets;
+		for (const property &p : e.properties)
+		{
+			const std::string &n = p.name;
+			std::vector<float> *target = nullptr;
+			if (vertices && !p.count_type)
+			{
+				target = n == "x" ? &out.x : n == "y" ? &out.y : n == "z" ? &out.z
+					: n == "nx" ? &out.nx : n == "ny" ? &out.ny : n == "nz" ? &out.nz
+					: (n == "u" || n == "s" || n == "texture_u") ? &out.tu
+					: (n == "v" || n == "t" || n == "texture_v") ? &out.tv : nullptr;
+			}
+			targets.push_back(target);
+			if (target)
+				target->reserve(e.count);
+		}
+
+		for (size_t row = 0; row < e.count; row++)
+		{
+			for (size_t j = 0; j < e.properties.size(); j++)
+			{
+				const property &p = e.properties[j];
+				double v;
+				if (!p.count_type)
+				{
+					if (!value(p.size, p.type, v))
+						return error(path, "the " + e.name + " data ends early");
+					if (targets[j])
+						targets[j]->push_back(float(v));
+					continue;
+				}
+
+				double length;
+				if (!value(p.count_size, p.count_type, length))
+					return error(path, "the " + e.name + " data ends early");
+				bool indices = faces && (p.name == "vertex_indices" || p.name == "vertex_index");
+				face.clear();
+				for (int i = 0; i < int(length); i++)
+				{
+					if (!value(p.size, p.type, v))
+						return error(path, "the " + e.name + " data ends early");
+					face.push_back(uint32_t(v));
+				}
+				if (!indices)
+					continue;
+				for (size_t i = 1; i + 1 < face.size(); i++)
+					out.indices.insert(out.indices.end(), {face[0], face[i], face[i + 1]});
+			}
+		}
+	}
+
+	size_t count = out.x.size();
+	if (count == 0 || out.y.size() != count || out.z.size() != count)
+		return error(path, "the vertices need x, y and z");
+	for (uint32_t index : out.indices)
+		if (index >= count)
+			return error(path, "a face refers to a missing vertex");
+	if (out.nx.size() != count || out.ny.size() != count || out.nz.size() != count)
+	{
+		out.nx.clear();
+		out.ny.clear();
+		out.nz.clear();
+	}
+	if (out.tu.size() != count || out.tv.size() != count)
+	{
+		out.tu.clear();
+		out.tv.clear();
+	}
+	if (out.indices.empty())
+		return error(path, "the mesh has no faces");
+	return true;
+}
+
+// load an OBJ or PLY mesh, chosen by the file's extension
+inline bool load_mesh(const std::string &path, mesh_data &out)
+{
+	std::string ext = path.substr(path.find_last_of('.') == std::string::npos ? path.size() : path.find_last_of('.'));
+	for (auto &c : ext)
+		c = char(std::tolower((unsigned char)c));
+	if (ext == ".obj")
+		return load_obj(path, out);
+	if (ext == ".ply")
+		return load_ply(path, out);
+	return mesh_loader::error(path, "unknown mesh format, expected .obj or .ply");
+}
+
+#endif
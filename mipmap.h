@@ -0,0 +1,225 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "rtweekend.h"
+#include "aligned_array.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Where the texels of an image and its chain of half-size copies down to 1x1 live. Texels are
+// linear 8-bit RGB in 8x8 tiles of exactly three cache lines, so the 2x2 texels of a bilinear
+// lookup mostly come from one or two lines instead of two rows a whole scanline apart. Tiles are
+// grouped into 64x64 pages, the unit a texture_cache loads and evicts; every level starts on a
+// page of its own, except the levels of at most 32x32, which share the last page.
+struct mip_layout
+{
+	static constexpr int tile_edge = 8;
+	static constexpr int page_edge = 64;
+	static constexpr size_t tile_bytes = tile_edge * tile_edge * 3;
+	static constexpr size_t page_bytes = (page_edge / tile_edge) * (page_edge / tile_edge) * tile_bytes;
+
+	struct level
+	{
+		int width, height;
+		int pages_x;		 // pages per row
+		int page_tiles_x;	 // tiles per row within a page
+		uint32_t first_page; // of the level
+		uint32_t base;		 // byte offset of the level within its pages, nonzero in the shared last page
+	};
+
+	std::vector<level> levels;
+	uint32_t page_count = 0;
+	int largest_edge = 0; // of the full-size image
+
+	mip_layout() = default;
+
+	mip_layout(int width, int height) : largest_edge(std::max(width, height))
+	{
+		uint32_t tail_page = 0, tail_bytes = 0;
+		bool has_tail = false;
+		for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2))
+		{
+			int tiles_x = (w + tile_edge - 1) / tile_edge, tiles_y = (h + tile_edge - 1) / tile_edge;
+			level lv{w, h, 1, std::min(tiles_x, page_edge / tile_edge), 0, 0};
+			if (w <= page_edge / 2 && h <= page_edge / 2)
+			{
+				if (!has_tail)
+				{
+					tail_page = page_count++;
+					has_tail = true;
+				}
+				lv.first_page = tail_page;
+				lv.base = tail_bytes;
+				tail_bytes += uint32_t(tiles_x * tiles_y * tile_bytes);
+			}
+			else
+			{
+				lv.pages_x = (w + page_edge - 1) / page_edge;
+				lv.first_page = page_count;
+				page_count += uint32_t(lv.pages_x * ((h + page_edge - 1) / page_edge));
+			}
+			levels.push_back(lv);
+			if (w == 1 && h == 1)
+				break;
+		}
+	}
+
+	// the page holding texel (x, y) of a level, and the texel's byte offset in it
+	static uint32_t page_of(const level &lv, int x, int y)
+	{
+		return lv.first_page + uint32_t((y / page_edge) * lv.pages_x + x / page_edge);
+	}
+
+	static size_t offset_in_page(const level &lv, int x, int y)
+	{
+		const int tiles = page_edge / tile_edge;
+		int tx = (x / tile_edge) % tiles, ty = (y / tile_edge) % tiles;
+		return lv.base + size_t(ty * lv.page_tiles_x + tx) * tile_bytes + size_t((y % tile_edge) * tile_edge + x % tile_edge) * 3;
+	}
+
+	// Filtered color at texture coordinates (u, v), with v = 0 the top row, for a footprint
+	// 'width' in texture coordinates across: bilinear on the level whose texels are about that
+	// wide, and trilinear between the two nearest levels in between. Footprints under a texel,
+	// a width of 0 among them, read the full-size image. Coordinates outside [0,1] clamp to the
+	// edge. fetch(level, x, y, rgb) copies the bytes of a texel to rgb.
+	template <typename Fetch>
+	color lookup(double u, double v, double width, Fetch &&fetch) const
+	{
+		float texels = float(width) * largest_edge;
+		if (!(texels > 1))
+			return bilinear(0, u, v, fetch);
+		float lod = std::log2(texels);
+		int last = int(levels.size()) - 1;
+		if (lod >= last)
+			return bilinear(last, u, v, fetch);
+		int l = int(lod);
+		float f = lod - l;
+		return (1 - f) * bilinear(l, u, v, fetch) + f * bilinear(l + 1, u, v, fetch);
+	}
+
+private:
+	template <typename Fetch>
+	color bilinear(int l, double u, double v, Fetch &fetch) const
+	{
+		const level &lv = levels[l];
+		// texel centers sit at half-integer coordinates; x, y > -1, so truncating x + 1 floors it
+		float x = float(u * lv.width) + 0.5f, y = float(v * lv.height) + 0.5f;
+		int ix = int(x), iy = int(y);
+		float tx = x - ix, ty = y - iy;
+		int x0 = std::clamp(ix - 1, 0, lv.width - 1), x1 = std::min(ix, lv.width - 1);
+		int y0 = std::clamp(iy - 1, 0, lv.height - 1), y1 = std::min(iy, lv.height - 1);
+		unsigned char a[3], b[3], c[3], d[3];
+		fetch(l, x0, y0, a);
+		fetch(l, x1, y0, b);
+		fetch(l, x0, y1, c);
+		fetch(l, x1, y1, d);
+		const float scale = 1.0f / 255.0f;
+		float w00 = (1 - tx) * (1 - ty) * scale, w10 = tx * (1 - ty) * scale;
+		float w01 = (1 - tx) * ty * scale, w11 = tx * ty * scale;
+		return color(w00 * a[0] + w10 * b[0] + w01 * c[0] + w11 * d[0], w00 * a[1] + w10 * b[1] + w01 * c[1] + w11 * d[1],
+					 w00 * a[2] + w10 * b[2] + w01 * c[2] + w11 * d[2]);
+	}
+};
+
+// A whole mip pyramid in memory, in the layout of mip_layout: all pages in one cache-line
+// aligned allocation, laid out as a texture_cache stores them on disk.
+class mipmap
+{
+public:
+	static constexpr size_t line_size = cache_line_size;
+
+	mipmap() = default;
+
+	// build the pyramid from 'width' x 'height' linear RGB floats, row by row from the top
+	mipmap(const float *rgb, int width, int height) : pages(width, height)
+	{
+		size_bytes = pages.page_count * mip_layout::page_bytes;
+		data = make_aligned_array<unsigned char>(size_bytes);
+		std::fill(data.get(), data.get() + size_bytes, 0);
+
+		// each level is a box-filtered half of the one before, odd edges reusing their last
+		// texel; only the floats of the level before are kept while building the next
+		const auto &levels = pages.levels;
+		store(levels[0], rgb);
+		std::vector<float> src, dst;
+		for (size_t l = 1; l < levels.size(); l++)
+		{
+			const mip_layout::level &from = levels[l - 1], &to = levels[l];
+			const float *in = l == 1 ? rgb : src.data();
+			dst.assign(size_t(to.width) * to.height * 3, 0);
+			for (int y = 0; y < to.height; y++)
+			{
+				int y0 = std::min(2 * y, from.height - 1), y1 = std::min(2 * y + 1, from.height - 1);
+				for (int x = 0; x < to.width; x++)
+				{
+					int x0 = std::min(2 * x, from.width - 1), x1 = std::min(2 * x + 1, from.width - 1);
+					for (int c = 0; c < 3; c++)
+						dst[(size_t(y) * to.width + x) * 3 + c] =
+							0.25f * (in[(size_t(y0) * from.width + x0) * 3 + c] + in[(size_t(y0) * from.width + x1) * 3 + c] +
+									 in[(size_t(y1) * from.width + x0) * 3 + c] + in[(size_t(y1) * from.width + x1) * 3 + c]);
+				}
+			}
+			store(to, dst.data());
+			src.swap(dst);
+		}
+	}
+
+	int width() const { return pages.levels.empty() ? 0 : pages.levels[0].width; }
+	int height() const { return pages.levels.empty() ? 0 : pages.levels[0].height; }
+	int level_count() const { return int(pages.levels.size()); }
+	const mip_layout &layout() const { return pages; }
+
+	// every page, one after the other
+	const unsigned char *bytes() const { return data.get(); }
+
+	// bytes held by all levels
+	size_t memory_bytes() const { return size_bytes; }
+
+	// the RGB bytes of texel (x, y) of a level, which must be inside it
+	const unsigned char *texel(int l, int x, int y) const { return texel_address(pages.levels[l], x, y); }
+
+	// see mip_layout::lookup
+	color lookup(double u, double v, double width) const
+	{
+		return pages.lookup(u, v, width, [this](int l, int x, int y, unsigned char *rgb)
+							{ std::memcpy(rgb, texel(l, x, y), 3); });
+	}
+
+private:
+	mip_layout pages;
+	aligned_array<unsigned char> data;
+	size_t size_bytes = 0;
+
+	unsigned char *texel_address(const mip_layout::level &lv, int x, int y) const
+	{
+		return data.get() + mip_layout::page_of(lv, x, y) * mip_layout::page_bytes + mip_layout::offset_in_page(lv, x, y);
+	}
+
+	// quantize a level's floats into its tiles
+	void store(const mip_layout::level &lv, const float *rgb)
+	{
+		for (int y = 0; y < lv.height; y++)
+		{
+			for (int x = 0; x < lv.width; x++)
+			{
+				unsigned char *t = texel_address(lv, x, y);
+				for (int c = 0; c < 3; c++)
+					t[c] = to_byte(rgb[(size_t(y) * lv.width + x) * 3 + c]);
+			}
+		}
+	}
+
+	static unsigned char to_byte(float value)
+	{
+		if (value <= 0.0f)
+			return 0;
+		if (value >= 1.0f)
+			return 255;
+		return static_cast<unsigned char>(256.0f * value);
+	}
+};
+
+#endif
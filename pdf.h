@@ -64,11 +64,12 @@ private:
     point3 origin;
 };
 
+// an even mix of two pdfs; it only refers to them, so both can live on the caller's stack
 class mixture_pdf : public pdf {
 public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-        p[0] = p0;
-        p[1] = p1;
+    mixture_pdf(const pdf& p0, const pdf& p1) {
+        p[0] = &p0;
+        p[1] = &p1;
     }
 
     double value(const vec3& direction) const override {
@@ -83,7 +84,7 @@ public:
     }
 
 private:
-    shared_ptr<pdf> p[2];
+    const pdf* p[2];
 };
 
 #endif
\ No newline at end of file
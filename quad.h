@@ -2,12 +2,13 @@
 #define QUAD_H
 
 #include "material.h"
+#include "material_table.h"
 #include "rtweekend.h"
 
 class quad : public hittable
 {
 public:
-	quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat) : Q(Q), u(u), v(v), mat(mat)
+	quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat) : Q(Q), u(u), v(v), mat(material_table::global().add(mat))
 	{
 
 		auto n = cross(u, v);
@@ -37,6 +38,29 @@ public:
 	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
 	{
 
+		double t, alpha, beta;
+		if (!intersect(r, ray_t, Q, u, v, w, normal, D, t, alpha, beta))
+			return false;
+
+		if (!is_interior(alpha, beta, rec))
+			return false;
+
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.mat = mat;
+		rec.set_face_normal(r, normal);
+		rec.uv_scale = 1 / sqrt(area);
+
+		return true;
+	}
+
+	// Intersect r with the plane of the quad spanned by u and v from Q, whose plane has the unit
+	// normal 'normal' and offset D, with w = n / (n . n) for the unnormalized normal n. On a hit
+	// inside ray_t, t is its distance and alpha, beta its plane coordinates; whether the hit
+	// point lies inside the quad is left to the caller.
+	static bool intersect(const ray &r, interval ray_t, const point3 &Q, const vec3 &u, const vec3 &v, const vec3 &w,
+						  const vec3 &normal, double D, double &t, double &alpha, double &beta)
+	{
 		auto denom = dot(normal, r.direction());
 
 		// no hit if the ray is parallel to the plane
@@ -44,27 +68,63 @@ public:
 			return false;
 
 		//  return false if the hit point parameter t is outside the ray interval
-		auto t = (D - dot(normal, r.origin())) / denom;
+		t = (D - dot(normal, r.origin())) / denom;
 		if (!ray_t.contains(t))
 			return false;
 
 		// determin the hit point lies within the planar shape using its plane coordinates
-		auto intersection = r.at(t);
-		vec3 planar_hitpt_vector = intersection - Q;
-		auto alpha = dot(w, cross(planar_hitpt_vector, v));
-		auto beta = dot(w, cross(u, planar_hitpt_vector));
-
-		if (!is_interior(alpha, beta, rec))
-			return false;
-
-		rec.t = t;
-		rec.p = intersection;
-		rec.mat = mat;
-		rec.set_face_normal(r, normal);
-
+		vec3 planar_hitpt_vector = r.at(t) - Q;
+		alpha = dot(w, cross(planar_hitpt_vector, v));
+		beta = dot(w, cross(u, planar_hitpt_vector));
 		return true;
 	}
 
+	// hit() for a whole packet: the plane distance and plane coordinates of all lanes are found
+	// in one SIMD loop, then is_interior() decides lane by lane as it does for single rays
+	uint32_t hit_packet(ray_packet &packet, uint32_t active, hit_record *recs) const override
+	{
+		const int n = ray_packet::max_size;
+		double ts[n], alphas[n], betas[n], found[n];
+
+#pragma omp simd
+		for (int k = 0; k < packet.size; k++)
+		{
+			double denom = normal[0] * packet.dir[0][k] + normal[1] * packet.dir[1][k] + normal[2] * packet.dir[2][k];
+			double t = (D - (normal[0] * packet.org[0][k] + normal[1] * packet.org[1][k] + normal[2] * packet.org[2][k])) / denom;
+
+			double p[3];
+			for (int a = 0; a < 3; a++)
+				p[a] = (packet.org[a][k] + t * packet.dir[a][k]) - Q[a];
+
+			// w . (p x v) and w . (u x p)
+			ts[k] = t;
+			alphas[k] = w[0] * (p[1] * v[2] - p[2] * v[1]) + w[1] * (p[2] * v[0] - p[0] * v[2]) + w[2] * (p[0] * v[1] - p[1] * v[0]);
+			betas[k] = w[0] * (u[1] * p[2] - u[2] * p[1]) + w[1] * (u[2] * p[0] - u[0] * p[2]) + w[2] * (u[0] * p[1] - u[1] * p[0]);
+			found[k] = !(fabs(denom) < 1e-8) & (packet.t_min[k] <= t) & (t <= packet.t_max[k]) ? 1.0 : 0.0;
+		}
+
+		uint32_t hits = 0;
+		for (uint32_t mask = lane_mask(found, packet.size) & active; mask; mask &= mask - 1)
+		{
+			int k = 0;
+			while (!(mask & (1u << k)))
+				k++;
+			hit_record &rec = recs[k];
+			if (!is_interior(alphas[k], betas[k], rec))
+				continue;
+
+			const ray &r = packet.rays[k];
+			rec.t = ts[k];
+			rec.p = r.at(ts[k]);
+			rec.mat = mat;
+			rec.set_face_normal(r, normal);
+			rec.uv_scale = 1 / sqrt(area);
+			packet.t_max[k] = ts[k];
+			hits |= 1u << k;
+		}
+		return hits;
+	}
+
 	// ϵ۳ֱu,valphabeta0~1֮
 	virtual bool is_interior(double a, double b, hit_record &rec) const
 	{
@@ -100,7 +160,7 @@ private:
 	point3 Q;
 	vec3 u, v;
 	vec3 w;
-	shared_ptr<material> mat;
+	const material *mat; // owned by material_table
 	aabb bbox;
 	vec3 normal;
 	double D; // ƽ淽̵Ax + By + Cz = D
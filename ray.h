@@ -7,8 +7,14 @@ class ray
 {
 public:
 	ray() {}
-	ray(const point3 &origin, const vec3 &direction) : orig(origin), dir(direction), tm(0) {}
-	ray(const point3 &origin, const vec3 &direction, double time) : orig(origin), dir(direction), tm(time) {}
+	ray(const point3 &origin, const vec3 &direction) : ray(origin, direction, 0) {}
+	ray(const point3 &origin, const vec3 &direction, double time) : orig(origin), dir(direction), tm(time)
+	{
+		// paid once per ray instead of once per bounding box test
+		inv_dir = vec3(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+		for (int axis = 0; axis < 3; axis++)
+			dir_is_neg[axis] = inv_dir[axis] < 0;
+	}
 
 	// ȡߵҿΪֵ
 	const point3 &origin() const
@@ -25,6 +31,18 @@ public:
 		return tm;
 	}
 
+	// 1 / direction, infinite along axes the ray is parallel to
+	const vec3 &inv_direction() const
+	{
+		return inv_dir;
+	}
+
+	// 1 if the direction is negative along 'axis', which makes the box max the near slab plane
+	int sign(int axis) const
+	{
+		return dir_is_neg[axis];
+	}
+
 	// atȡraytʱĵĵλ
 	point3
 	at(double t) const
@@ -36,6 +54,8 @@ private:
 	point3 orig;
 	vec3 dir;
 	double tm;
+	vec3 inv_dir;
+	int dir_is_neg[3];
 };
 
 #endif
\ No newline at end of file
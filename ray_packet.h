@@ -0,0 +1,70 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rtweekend.h"
+#include <cstdint>
+
+// Up to 16 rays traced together. Besides the rays themselves the packet keeps their origins,
+// directions and search intervals in SoA form, so BVH nodes, spheres and quads can test all
+// lanes in one SIMD loop. Sets of lanes are passed around as bit masks, bit k meaning lane k.
+class ray_packet
+{
+public:
+	static constexpr int max_size = 16;
+
+	// Lanes are added together with the calling thread's current random stream, so a lane can
+	// later be intersected and shaded with exactly the random numbers a lone ray would have used.
+
+	int size = 0;
+	ray rays[max_size];
+	double org[3][max_size];
+	double dir[3][max_size];
+	double inv_dir[3][max_size];
+	int sign[3][max_size];
+	double time[max_size];
+	double t_min[max_size];
+	double t_max[max_size]; // shrinks to the closest hit found so far
+	rng_engine rng[max_size];	 // each lane's random stream, for primitives that sample while intersecting
+
+	void add(const ray &r, interval ray_t)
+	{
+		int k = size++;
+		rays[k] = r;
+		for (int a = 0; a < 3; a++)
+		{
+			org[a][k] = r.origin()[a];
+			dir[a][k] = r.direction()[a];
+			inv_dir[a][k] = r.inv_direction()[a];
+			sign[a][k] = r.sign(a);
+		}
+		time[k] = r.time();
+		t_min[k] = ray_t.min;
+		t_max[k] = ray_t.max;
+		rng[k] = thread_rng();
+	}
+
+	// mask of every lane in use
+	uint32_t lanes() const { return (uint32_t(1) << size) - 1; }
+};
+
+// number of lanes set in a mask
+inline int lane_count(uint32_t mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+// Turn the flags of the first 'count' lanes into a lane mask. SIMD loops over the lanes write
+// their flags as 1.0 / 0.0 doubles: a compiler targeting plain SSE2 won't vectorize a loop that
+// narrows double comparisons down to a bool array.
+inline uint32_t lane_mask(const double (&flags)[ray_packet::max_size], int count)
+{
+	uint32_t mask = 0;
+	for (int k = 0; k < count; k++)
+		mask |= uint32_t(flags[k] != 0) << k;
+	return mask;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// Per-thread random number generation.
+//
+// Every thread owns its own generator, so render threads never contend on a shared state.
+// The camera reseeds the calling thread's generator from (seed, pixel, sample) before each
+// camera sample; the n-th random number drawn while tracing that sample is then the n-th
+// "dimension" of a stream that depends only on those three values, which makes renders
+// bit-reproducible regardless of the thread count or the order pixels are scheduled in.
+
+// 64-bit finalizer from SplitMix64, used to decorrelate nearby seeds
+inline uint64_t mix_bits(uint64_t v)
+{
+	v ^= v >> 31;
+	v *= 0x7fb5d329728ea185ULL;
+	v ^= v >> 27;
+	v *= 0x81dadef4bc2dd44dULL;
+	v ^= v >> 33;
+	return v;
+}
+
+// PCG32 (XSH-RR variant), see https://www.pcg-random.org
+class pcg32
+{
+public:
+	pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+	pcg32(uint64_t init_state, uint64_t init_seq) { seed(init_state, init_seq); }
+
+	void seed(uint64_t init_state, uint64_t init_seq)
+	{
+		state = 0;
+		inc = (init_seq << 1) | 1;
+		next_uint();
+		state += init_state;
+		next_uint();
+	}
+
+	uint32_t next_uint()
+	{
+		uint64_t old_state = state;
+		state = old_state * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+		uint32_t rot = uint32_t(old_state >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	// return a random real in [0,1)
+	double next_double()
+	{
+		return next_uint() * (1.0 / 4294967296.0);
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+// the generator used for all of the renderer's random numbers; swap it here to plug in another engine
+// (it only needs seed(state, seq) and next_double())
+using rng_engine = pcg32;
+
+// the calling thread's generator
+inline rng_engine &thread_rng()
+{
+	thread_local rng_engine rng;
+	return rng;
+}
+
+// restart the calling thread's random stream for camera sample 'sample' of pixel 'pixel'
+inline void seed_thread_rng(uint64_t seed, uint64_t pixel, uint64_t sample)
+{
+	thread_rng().seed(mix_bits(seed ^ mix_bits(pixel)), mix_bits(sample + 0x9e3779b97f4a7c15ULL));
+}
+
+#endif
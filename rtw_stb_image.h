@@ -10,6 +10,7 @@
 #define STBI_FAILURE_USERMSG
 
 #include "./external/stb_image.h"
+#include "mipmap.h"
 
 #include <iostream>
 #include <cstdlib>
@@ -28,79 +29,81 @@ public:
 		// parent, on so on, for six levels up. If the image was not loaded successfully,
 		// width() and height() will return 0.
 
-		auto filename = std::string(image_filename);
-		auto imagedir = getenv("RTW_IMAGES");
-
-		// hunt for the image file in some likely location
-		if (imagedir && load(std::string(imagedir) + '/' + filename))
-			return;
-		if (load(filename))
-			return;
-		if (load("images/" + filename))
-			return;
-		if (load("../images/" + filename))
-			return;
-		if (load("../../images/" + filename))
-			return;
-		if (load("../../../images/" + filename))
-			return;
-		if (load("../../../../images/" + filename))
-			return;
-		if (load("../../../../../images/" + filename))
-			return;
-		if (load("../../../../../../images/" + filename))
+		std::string path = find(image_filename);
+		if (!path.empty() && load(path))
 			return;
 
 		std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
 	}
 
-	~rtw_image()
+	// the first of the places described above holding an image stb_image recognizes, judging by
+	// its header alone; empty if there is none
+	static std::string find(const std::string &filename)
 	{
-		delete[] bdata;
-		STBI_FREE(fdata);
+		auto imagedir = getenv("RTW_IMAGES");
+		if (imagedir && readable(std::string(imagedir) + '/' + filename))
+			return std::string(imagedir) + '/' + filename;
+		if (readable(filename))
+			return filename;
+		std::string prefix = "images/";
+		for (int up = 0; up <= 6; up++, prefix = "../" + prefix)
+			if (readable(prefix + filename))
+				return prefix + filename;
+		return std::string();
 	}
 
 	bool load(const std::string &filename)
 	{
 		// loads the linear (gamma = 1) image data from the given file name. return true if the load succeeded.
-		// the resulting data buffer contains the there [0.0,1.0] floating-point values for the first pixel(red,then green,then blue).
-		// pixels are contiguous, going left to right for the width of the image, followed by the next row below, for the full height of the image.
+		// the decoded floats only live until the mip pyramid is built from them; the pyramid keeps
+		// linear 8-bit texels.
 
 		auto n = bytes_per_pixel;
-		fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+		float *fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
 		if (fdata == nullptr)
 			return false;
 
-		bytes_per_scanline = image_width * bytes_per_pixel;
-
-		convert_to_bytes();
+		pyramid = mipmap(fdata, image_width, image_height);
+		STBI_FREE(fdata);
 
+		std::clog << "loaded " << filename << ": " << image_width << 'x' << image_height << ", "
+				  << pyramid.level_count() << " mip levels in " << memory_bytes() / 1024.0 << " KB\n";
 		return true;
 	}
 
-	int width() const { return (fdata == nullptr) ? 0 : image_width; }
-	int height() const { return (fdata == nullptr) ? 0 : image_height; }
+	int width() const { return pyramid.width(); }
+	int height() const { return pyramid.height(); }
+
+	// the image and its mip levels
+	const mipmap &mips() const { return pyramid; }
+
+	// bytes held by the texels of every level
+	size_t memory_bytes() const { return pyramid.memory_bytes(); }
 
 	const unsigned char *pixel_data(int x, int y) const
 	{
 		// return the address of the three RGB bytes of the pixel at x,y
 		// If there is no image data,return magenta
 		static unsigned char magenta[] = {255, 0, 255}; // ɫ
-		if (bdata == nullptr)
+		if (pyramid.width() == 0)
 			return magenta;
 		x = clamp(x, 0, image_width);
 		y = clamp(y, 0, image_height);
 
-		return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
+		return pyramid.texel(0, x, y);
 	}
 
 private:
 	const int bytes_per_pixel = 3;	// rgb ռһֽڣͨ
-	float *fdata = nullptr;			// ͼԸʽ洢fdata
-	unsigned char *bdata = nullptr; // linear 8-bit pixel data
+	mipmap pyramid;					// the texels, in tiles
 	int image_width = 0;			// loaded image width
 	int image_height = 0;			// loaded image height
-	int bytes_per_scanline = 0;
+
+	static bool readable(const std::string &path)
+	{
+		int x, y, n;
+		return stbi_info(path.c_str(), &x, &y, &n) != 0;
+	}
 
 	static int clamp(int x, int low, int high)
 	{
@@ -110,31 +113,6 @@ private:
 			return x;
 		return high - 1;
 	}
-
-	static unsigned char float_to_byte(float value)
-	{
-		if (value <= 0.0)
-			return 0;
-		if (value >= 1.0)
-			return 255;
-		return static_cast<unsigned char>(256.0 * value); // floatתΪ8-bitsַchar
-	}
-
-	void convert_to_bytes()
-	{
-		// convert the linear floating point pixel data to bytes,storing the resulting byte data in the 'bdata' member
-		int total_bytes = image_width * image_height * bytes_per_pixel;
-		// һ̬ unsigned char 
-		bdata = new unsigned char[total_bytes];
-
-		// iterate through all pixel components, converting from [0.0,1.0] float values to unsigned [0,255] byte values
-		auto *bptr = bdata;
-		auto *fptr = fdata;
-		for (auto i = 0; i < total_bytes; i++, fptr++, bptr++)
-		{
-			*bptr = float_to_byte(*fptr);
-		}
-	}
 };
 
 // restore MSVC compiler warnings
@@ -8,6 +8,8 @@
 #include <memory>
 #include <vector>
 
+#include "rng.h"
+
 using std::make_shared;
 using std::shared_ptr;
 using std::vector;
@@ -25,8 +27,8 @@ inline double degrees_to_radians(double degress)
 
 inline double random_double()
 {
-	// return a random real in [0,1)
-	return rand() / (RAND_MAX + 1.0);
+	// return a random real in [0,1) from the calling thread's generator
+	return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max)
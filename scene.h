@@ -0,0 +1,688 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "flat_scene.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "mesh_loader.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A scene file is plain text, one statement per line; '#' starts a comment. Names refer to the
+// textures, materials and objects defined on earlier lines. COLOR, POINT and VECTOR are three
+// numbers; where a COLOR|TEXTURE is expected either a color or a texture name may follow.
+//
+//   camera KEY VALUE...     width aspect spp max_depth min_depth vfov lookfrom lookat vup
+//                           defocus_angle focus_dist background
+//                           min_depth is how many rays a path traces before Russian roulette may
+//                           end it, 3 by default; roulette changes the noise, not the expected
+//                           image; min_depth >= max_depth traces every path to full depth
+//   texture NAME solid COLOR | checker SCALE COLOR|TEXTURE COLOR|TEXTURE | image FILE
+//                | noise SCALE [OCTAVES]   marble if OCTAVES > 0: stripes bent by turbulence
+//                | blend COLOR|TEXTURE COLOR|TEXTURE AMOUNT   AMOUNT of the second, the rest of the first
+//   material NAME lambertian COLOR|TEXTURE | metal COLOR FUZZ | dielectric INDEX
+//                 | light COLOR|TEXTURE | isotropic COLOR|TEXTURE
+//   SHAPE                   adds the shape to the scene (or to the group being defined)
+//   def NAME SHAPE          names the shape without adding it
+//   add NAME                adds a named shape
+//   light SHAPE             importance samples scattered rays towards the shape; SHAPE leaves out
+//                           its material, and the scene still needs an emitter there to be lit
+//   group NAME ... end      gathers the shapes added in between under a BVH, named NAME
+//
+// with SHAPE one of
+//   sphere MATERIAL POINT RADIUS
+//   moving_sphere MATERIAL POINT POINT RADIUS
+//   quad MATERIAL POINT VECTOR VECTOR
+//   box MATERIAL POINT POINT
+//   mesh MATERIAL FILE      a triangle mesh from an .obj or .ply file; can't be a light
+//   translate NAME VECTOR
+//   rotate_y NAME DEGREES
+//   instance NAME OP...     the shape under the transforms OP in order, each one of
+//                           translate VECTOR, rotate VECTOR DEGREES (about the axis) or scale VECTOR;
+//                           instances of one shape share its geometry
+//   medium NAME DENSITY COLOR|TEXTURE
+struct scene
+{
+	camera cam;
+	hittable_list world;  // one BVH over the top-level shapes
+	hittable_list lights; // shapes towards which scattered rays are sampled, may be empty
+
+	size_t shape_count = 0;	  // shape statements read, boxes counting as one
+	double parse_seconds = 0; // reading the file and loading textures, without building BVHs
+	double bvh_seconds = 0;	  // building the BVHs of the groups and the scene
+
+	void render()
+	{
+		if (lights.objects.empty())
+			cam.render(world);
+		else
+			cam.render(world, lights);
+	}
+};
+
+// Reads scene files into a scene, line by line without holding the whole file in memory.
+// Given a flat_scene_data, the parser also records the scene there as flat arrays for a scene
+// cache; the cache builds its own BVH, so the parser then leaves the scene and its groups as
+// plain lists.
+class scene_parser
+{
+public:
+	explicit scene_parser(scene &out, flat_scene_data *flat_out = nullptr)
+		: out(out), flat(flat_out ? *flat_out : own_flat), flatten(flat_out != nullptr) {}
+
+	// parse the stream and build the scene's BVH; errors are reported to std::cerr with the
+	// line they were found on
+	bool parse(std::istream &in, const std::string &name)
+	{
+		auto start = std::chrono::steady_clock::now();
+		groups.assign(1, group{"", hittable_list(), {}});
+
+		std::string line;
+		int line_number = 0;
+		while (std::getline(in, line))
+		{
+			line_number++;
+			if (!tokenize(line))
+				return error(name, line_number, "unterminated quote");
+			if (tokens.empty())
+				continue;
+			if (!statement())
+				return error(name, line_number, message);
+		}
+		if (groups.size() > 1)
+			return error(name, line_number, "group '" + groups.back().name + "' is missing its 'end'");
+		if (groups[0].objects.objects.empty())
+			return error(name, line_number, "the scene has no shapes");
+
+		auto bvh_start = std::chrono::steady_clock::now();
+		if (flatten)
+		{
+			out.world = groups[0].objects;
+			flat.world = std::move(groups[0].ids);
+		}
+		else
+			out.world = hittable_list(make_shared<bvh_node>(groups[0].objects));
+		auto end = std::chrono::steady_clock::now();
+		out.bvh_seconds += std::chrono::duration<double>(end - bvh_start).count();
+		out.parse_seconds = std::chrono::duration<double>(end - start).count() - out.bvh_seconds;
+		return true;
+	}
+
+private:
+	struct group
+	{
+		std::string name;
+		hittable_list objects;
+		std::vector<uint32_t> ids; // primitive ids of the objects, when flattening
+	};
+
+	scene &out;
+	flat_scene_data own_flat; // the texture and material records, when not flattening for a cache
+	flat_scene_data &flat;
+	bool flatten;
+	std::vector<std::string_view> tokens; // of the current line
+	size_t next = 0;					  // first token not yet consumed
+	std::string message;				  // what went wrong on the current line
+
+	// textures and materials are made from their records in 'flat', and named by record index
+	std::map<std::string, uint32_t, std::less<>> textures;
+	std::map<std::string, uint32_t, std::less<>> materials;
+	std::vector<shared_ptr<texture>> made_textures;
+	std::vector<shared_ptr<material>> made_materials;
+
+	std::map<std::string, shared_ptr<hittable>, std::less<>> objects;
+	std::map<std::string, std::vector<uint32_t>, std::less<>> flat_objects; // primitive ids of the objects
+	std::vector<uint32_t> shape_ids;										// of the shape just read
+	std::vector<group> groups; // the scene itself, then the groups being defined
+
+	static bool error(const std::string &name, int line_number, const std::string &what)
+	{
+		std::cerr << "ERROR: " << name << ":" << line_number << ": " << what << "\n";
+		return false;
+	}
+
+	bool fail(const std::string &what)
+	{
+		message = what;
+		return false;
+	}
+
+	// split a line into tokens at whitespace, up to a '#'; "quoted text" is one token
+	bool tokenize(std::string_view line)
+	{
+		tokens.clear();
+		next = 0;
+		size_t k = 0;
+		while (true)
+		{
+			while (k < line.size() && std::isspace((unsigned char)line[k]))
+				k++;
+			if (k == line.size() || line[k] == '#')
+				return true;
+			size_t begin = k;
+			if (line[k] == '"')
+			{
+				size_t close = line.find('"', k + 1);
+				if (close == std::string_view::npos)
+					return false;
+				tokens.push_back(line.substr(k + 1, close - k - 1));
+				k = close + 1;
+				continue;
+			}
+			while (k < line.size() && !std::isspace((unsigned char)line[k]) && line[k] != '#')
+				k++;
+			tokens.push_back(line.substr(begin, k - begin));
+		}
+	}
+
+	bool more() const { return next < tokens.size(); }
+
+	bool word(std::string_view &w, const char *what)
+	{
+		if (!more())
+			return fail(std::string("expected ") + what);
+		w = tokens[next++];
+		return true;
+	}
+
+	static bool is_number(std::string_view w)
+	{
+		double v;
+		auto [end, ec] = std::from_chars(w.data(), w.data() + w.size(), v);
+		return ec == std::errc() && end == w.data() + w.size();
+	}
+
+	bool number(double &v, const char *what)
+	{
+		std::string_view w;
+		if (!word(w, what))
+			return false;
+		auto [end, ec] = std::from_chars(w.data(), w.data() + w.size(), v);
+		if (ec != std::errc() || end != w.data() + w.size())
+			return fail(std::string("expected ") + what + ", found '" + std::string(w) + "'");
+		return true;
+	}
+
+	bool triple(vec3 &v, const char *what)
+	{
+		return number(v[0], what) && number(v[1], what) && number(v[2], what);
+	}
+
+	template <typename T>
+	bool lookup(const std::map<std::string, T, std::less<>> &table, T &value, const char *what)
+	{
+		std::string_view w;
+		if (!word(w, what))
+			return false;
+		auto it = table.find(w);
+		if (it == table.end())
+			return fail(std::string("unknown ") + what + " '" + std::string(w) + "'");
+		value = it->second;
+		return true;
+	}
+
+	// the primitive ids of the object named by the token just read
+	const std::vector<uint32_t> &named_ids() const { return flat_objects.find(tokens[next - 1])->second; }
+
+	uint32_t add_texture(const flat_texture &t)
+	{
+		flat.textures.push_back(t);
+		made_textures.push_back(make_texture(t, made_textures, flat.strings.c_str()));
+		return uint32_t(flat.textures.size() - 1);
+	}
+
+	bool color_or_texture(uint32_t &tex)
+	{
+		if (more() && is_number(tokens[next]))
+		{
+			flat_texture t;
+			if (!triple(t.albedo, "a color"))
+				return false;
+			tex = add_texture(t);
+			return true;
+		}
+		return lookup(textures, tex, "texture");
+	}
+
+	bool finished()
+	{
+		if (more())
+			return fail("unexpected '" + std::string(tokens[next]) + "'");
+		return true;
+	}
+
+	bool statement()
+	{
+		std::string_view keyword = tokens[next++];
+		if (keyword == "camera")
+			return camera_settings();
+		if (keyword == "texture")
+			return texture_definition();
+		if (keyword == "material")
+			return material_definition();
+
+		std::string_view name;
+		shared_ptr<hittable> object;
+		if (keyword == "def")
+		{
+			if (!word(name, "a name") || !word(keyword, "a shape") || !shape(keyword, true, object) || !finished())
+				return false;
+			objects[std::string(name)] = object;
+			if (flatten)
+				flat_objects[std::string(name)] = shape_ids;
+			return true;
+		}
+		if (keyword == "add")
+		{
+			if (!lookup(objects, object, "shape") || !finished())
+				return false;
+			groups.back().objects.add(object);
+			if (flatten)
+			{
+				const auto &ids = named_ids();
+				groups.back().ids.insert(groups.back().ids.end(), ids.begin(), ids.end());
+			}
+			return true;
+		}
+		if (keyword == "light")
+		{
+			if (!word(keyword, "a shape") || !shape(keyword, false, object) || !finished())
+				return false;
+			out.lights.add(object);
+			flat.lights.insert(flat.lights.end(), shape_ids.begin(), shape_ids.end());
+			return true;
+		}
+		if (keyword == "group")
+		{
+			if (!word(name, "a name") || !finished())
+				return false;
+			groups.push_back(group{std::string(name), hittable_list(), {}});
+			return true;
+		}
+		if (keyword == "end")
+		{
+			if (groups.size() < 2)
+				return fail("'end' outside of a group");
+			if (!finished())
+				return false;
+			group g = std::move(groups.back());
+			groups.pop_back();
+			if (g.objects.objects.empty())
+				return fail("group '" + g.name + "' is empty");
+
+			if (flatten)
+			{
+				objects[g.name] = make_shared<hittable_list>(g.objects);
+				flat_objects[g.name] = std::move(g.ids);
+				return true;
+			}
+			auto bvh_start = std::chrono::steady_clock::now();
+			objects[g.name] = make_shared<bvh_node>(g.objects);
+			out.bvh_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count();
+			return true;
+		}
+
+		if (!shape(keyword, true, object) || !finished())
+			return false;
+		groups.back().objects.add(object);
+		groups.back().ids.insert(groups.back().ids.end(), shape_ids.begin(), shape_ids.end());
+		return true;
+	}
+
+	bool camera_settings()
+	{
+		camera &cam = out.cam;
+		std::string_view key;
+		while (word(key, "a camera setting"))
+		{
+			int *int_value = nullptr;
+			double *double_value = nullptr;
+			vec3 *vec3_value = nullptr;
+			if (key == "width")
+				int_value = &cam.image_width;
+			else if (key == "spp")
+				int_value = &cam.samples_per_pixel;
+			else if (key == "max_depth")
+				int_value = &cam.max_depth;
+			else if (key == "min_depth")
+				int_value = &cam.min_depth;
+			else if (key == "aspect")
+				double_value = &cam.aspect_ratio;
+			else if (key == "vfov")
+				double_value = &cam.vfov;
+			else if (key == "defocus_angle")
+				double_value = &cam.defocus_angle;
+			else if (key == "focus_dist")
+				double_value = &cam.focus_dist;
+			else if (key == "lookfrom")
+				vec3_value = &cam.lookfrom;
+			else if (key == "lookat")
+				vec3_value = &cam.lookat;
+			else if (key == "vup")
+				vec3_value = &cam.vup;
+			else if (key == "background")
+				vec3_value = &cam.background;
+			else
+				return fail("unknown camera setting '" + std::string(key) + "'");
+
+			double v;
+			if (vec3_value)
+			{
+				if (!triple(*vec3_value, "three numbers"))
+					return false;
+			}
+			else if (!number(v, "a number"))
+				return false;
+			else if (int_value)
+				*int_value = int(v);
+			else
+				*double_value = v;
+			if (!more())
+				return true;
+		}
+		return false;
+	}
+
+	bool texture_definition()
+	{
+		std::string_view name, kind;
+		if (!word(name, "a name") || !word(kind, "a texture type"))
+			return false;
+
+		flat_texture t;
+		if (kind == "solid")
+		{
+			if (!triple(t.albedo, "a color"))
+				return false;
+		}
+		else if (kind == "checker")
+		{
+			t.kind = flat_texture::checker;
+			if (!number(t.scale, "a scale") || !color_or_texture(t.even) || !color_or_texture(t.odd))
+				return false;
+		}
+		else if (kind == "image")
+		{
+			std::string_view file;
+			if (!word(file, "a file name"))
+				return false;
+			t.kind = flat_texture::image;
+			t.name = flat.add_string(file);
+		}
+		else if (kind == "blend")
+		{
+			t.kind = flat_texture::blend;
+			if (!color_or_texture(t.even) || !color_or_texture(t.odd) || !number(t.scale, "an amount"))
+				return false;
+		}
+		else if (kind == "noise")
+		{
+			t.kind = flat_texture::noise;
+			if (!number(t.scale, "a scale"))
+				return false;
+			double octaves = 0;
+			if (more() && !number(octaves, "a number of octaves"))
+				return false;
+			if (octaves < 0 || octaves != int(octaves))
+				return fail("the octaves of a noise texture must be a whole number");
+			t.octaves = uint32_t(octaves);
+		}
+		else
+			return fail("unknown texture type '" + std::string(kind) + "'");
+
+		if (!finished())
+			return false;
+		textures[std::string(name)] = add_texture(t);
+		return true;
+	}
+
+	bool material_definition()
+	{
+		std::string_view name, kind;
+		if (!word(name, "a name") || !word(kind, "a material type"))
+			return false;
+
+		flat_material m;
+		if (kind == "lambertian")
+		{
+			if (!color_or_texture(m.texture))
+				return false;
+		}
+		else if (kind == "metal")
+		{
+			m.kind = flat_material::metal;
+			if (!triple(m.albedo, "a color") || !number(m.param, "a fuzz"))
+				return false;
+		}
+		else if (kind == "dielectric")
+		{
+			m.kind = flat_material::dielectric;
+			if (!number(m.param, "a refraction index"))
+				return false;
+		}
+		else if (kind == "light")
+		{
+			m.kind = flat_material::light;
+			if (!color_or_texture(m.texture))
+				return false;
+		}
+		else if (kind == "isotropic")
+		{
+			m.kind = flat_material::isotropic;
+			if (!color_or_texture(m.texture))
+				return false;
+		}
+		else
+			return fail("unknown material type '" + std::string(kind) + "'");
+
+		if (!finished())
+			return false;
+		flat.materials.push_back(m);
+		made_materials.push_back(make_material(m, made_textures));
+		materials[std::string(name)] = uint32_t(flat.materials.size() - 1);
+		return true;
+	}
+
+	// Read the shape named by keyword. Shapes used as lights have no material. When flattening,
+	// the shape's primitives are also recorded, and their ids left in shape_ids.
+	bool shape(std::string_view keyword, bool with_material, shared_ptr<hittable> &object)
+	{
+		uint32_t mat_index = flat_none;
+		shared_ptr<material> mat;
+		bool has_material = keyword == "sphere" || keyword == "moving_sphere" || keyword == "quad" || keyword == "box" ||
+							keyword == "mesh";
+		if (has_material && with_material)
+		{
+			if (!lookup(materials, mat_index, "material"))
+				return false;
+			mat = made_materials[mat_index];
+		}
+		out.shape_count++;
+		shape_ids.clear();
+
+		if (keyword == "sphere")
+		{
+			point3 center;
+			double radius;
+			if (!triple(center, "a point") || !number(radius, "a radius"))
+				return false;
+			object = make_shared<sphere>(center, radius, mat);
+			if (flatten)
+				shape_ids.push_back(flat.add_sphere(center, vec3(0, 0, 0), radius, mat_index));
+		}
+		else if (keyword == "moving_sphere")
+		{
+			point3 center1, center2;
+			double radius;
+			if (!triple(center1, "a point") || !triple(center2, "a point") || !number(radius, "a radius"))
+				return false;
+			object = make_shared<sphere>(center1, center2, radius, mat);
+			if (flatten)
+				shape_ids.push_back(flat.add_sphere(center1, center2 - center1, radius, mat_index));
+		}
+		else if (keyword == "quad")
+		{
+			point3 q;
+			vec3 u, v;
+			if (!triple(q, "a point") || !triple(u, "a vector") || !triple(v, "a vector"))
+				return false;
+			object = make_shared<quad>(q, u, v, mat);
+			if (flatten)
+				shape_ids.push_back(flat.add_quad(q, u, v, mat_index));
+		}
+		else if (keyword == "box")
+		{
+			point3 a, b;
+			if (!triple(a, "a point") || !triple(b, "a point"))
+				return false;
+			object = box(a, b, mat);
+			if (flatten)
+				flat.add_box(a, b, mat_index, shape_ids);
+		}
+		else if (keyword == "mesh")
+		{
+			// lights are sampled by direction, which meshes don't implement
+			if (!with_material)
+				return fail("a mesh can't be a light");
+			std::string_view file;
+			mesh_data mesh;
+			if (!word(file, "a file name"))
+				return false;
+			// keyed before reading, so a change while it is read invalidates the cache
+			if (flatten)
+				flat.add_dependency(std::string(file));
+			out.cam.scene_key = mix_bits(out.cam.scene_key ^ file_source_key(std::string(file)));
+			if (!load_mesh(std::string(file), mesh))
+				return fail("could not load the mesh '" + std::string(file) + "'");
+			if (flatten)
+				flat.add_mesh(mesh, mat_index, shape_ids);
+			auto triangles = make_shared<triangle_mesh>(std::move(mesh), mat);
+			out.bvh_seconds += triangles->bvh().build_seconds;
+			object = triangles;
+		}
+		else if (keyword == "translate")
+		{
+			shared_ptr<hittable> inner;
+			vec3 offset;
+			if (!lookup(objects, inner, "shape"))
+				return false;
+			const std::vector<uint32_t> *ids = flatten ? &named_ids() : nullptr;
+			if (!triple(offset, "a vector"))
+				return false;
+			object = make_shared<translate>(inner, offset);
+			if (flatten)
+				flat.transformed(*ids, affine3::translation(offset), shape_ids);
+		}
+		else if (keyword == "rotate_y")
+		{
+			shared_ptr<hittable> inner;
+			double degrees;
+			if (!lookup(objects, inner, "shape"))
+				return false;
+			const std::vector<uint32_t> *ids = flatten ? &named_ids() : nullptr;
+			if (!number(degrees, "an angle"))
+				return false;
+			object = make_shared<rotate_y>(inner, degrees);
+			if (flatten)
+				flat.transformed(*ids, affine3::rotation_y(degrees), shape_ids);
+		}
+		else if (keyword == "instance")
+		{
+			shared_ptr<hittable> inner;
+			if (!lookup(objects, inner, "shape"))
+				return false;
+			const std::vector<uint32_t> *ids = flatten ? &named_ids() : nullptr;
+			affine3 map = affine3::identity();
+			if (!more())
+				return fail("expected a transform");
+			while (more())
+			{
+				std::string_view op;
+				vec3 v;
+				double degrees;
+				word(op, "a transform");
+				if (op == "translate")
+				{
+					if (!triple(v, "a vector"))
+						return false;
+					map = affine3::translation(v) * map;
+				}
+				else if (op == "rotate")
+				{
+					if (!triple(v, "an axis") || !number(degrees, "an angle"))
+						return false;
+					if (v.length_squared() == 0)
+						return fail("the rotation axis is zero");
+					map = affine3::rotation(v, degrees) * map;
+				}
+				else if (op == "scale")
+				{
+					if (!triple(v, "a vector"))
+						return false;
+					if (v[0] == 0 || v[1] == 0 || v[2] == 0)
+						return fail("a scale factor is zero");
+					map = affine3::scaling(v) * map;
+				}
+				else
+					return fail("unknown transform '" + std::string(op) + "'");
+			}
+			object = make_shared<instance>(inner, map);
+			// the cache stores its primitives in world space, so each instance is a copy there
+			if (flatten)
+			{
+				for (uint32_t id : *ids)
+					if (!flat.keeps_shape(id, map))
+						return fail("a sphere can't be scaled unevenly in a scene cache");
+				flat.transformed(*ids, map, shape_ids);
+			}
+		}
+		else if (keyword == "medium")
+		{
+			shared_ptr<hittable> boundary;
+			double density;
+			uint32_t tex;
+			if (!lookup(objects, boundary, "shape"))
+				return false;
+			const std::vector<uint32_t> *ids = flatten ? &named_ids() : nullptr;
+			if (!number(density, "a density") || !color_or_texture(tex))
+				return false;
+			object = make_shared<constant_medium>(boundary, density, made_textures[tex]);
+			if (flatten)
+				shape_ids.push_back(flat.add_medium(*ids, density, tex));
+		}
+		else
+			return fail("unknown statement '" + std::string(keyword) + "'");
+		return true;
+	}
+};
+
+// load the scene file at path into out, reporting errors to std::cerr
+inline bool load_scene(const std::string &path, scene &out)
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		std::cerr << "ERROR: Could not open the scene '" << path << "'.\n";
+		return false;
+	}
+	out.cam.scene_key = file_source_key(path);
+	return scene_parser(out).parse(in, path);
+}
+
+#endif
@@ -0,0 +1,595 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "rtweekend.h"
+#include "flat_scene.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A scene cache is a scene file turned into its flat arrays (see flat_scene.h) and the BVH over
+// them, laid out so that mapping the file into memory is all loading it takes: there is nothing
+// to parse and no per-shape object to allocate, so a warm start costs milliseconds whatever the
+// size of the scene. Only textures, materials, media and lights, which are few, become objects.
+//
+// The file is the header followed by the sections it lists, each starting on a 64-byte boundary.
+// The header records the size and modification time of the scene file the cache was made from,
+// and the dependencies section those of the other files it read, such as meshes; a cache is only
+// used while all of them match. Everything is in the native byte order.
+struct scene_cache_camera
+{
+	int32_t width, spp, max_depth, min_depth;
+	double aspect, vfov, defocus_angle, focus_dist;
+	vec3 lookfrom, lookat, vup, background;
+};
+
+struct scene_cache_header
+{
+	enum section_t
+	{
+		textures,
+		materials,
+		spheres,
+		quads,
+		triangles,
+		vertices, // one section per flat_vertex_attribute
+		media = vertices + vertex_attribute_count,
+		medium_ids,
+		lights,
+		dependencies,
+		nodes,
+		slots,
+		strings,
+		section_count
+	};
+
+	struct section
+	{
+		uint64_t offset, count; // in bytes from the start of the file, in elements
+	};
+
+	char magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\n'};
+	uint32_t version = 3;
+	uint32_t layout = 0;	 // record sizes, so a build with a different layout won't misread
+	uint64_t source_key = 0; // of the scene file, see file_source_key()
+	uint64_t file_size = 0;
+	uint64_t checksum = 0; // see scene_cache_checksum()
+	scene_cache_camera camera{};
+	section sections[section_count]{};
+
+	// the size of an element of section s
+	static size_t element_size(int s)
+	{
+		if (s >= vertices && s < int(vertices + vertex_attribute_count))
+			return sizeof(double);
+		switch (s)
+		{
+		case textures:
+			return sizeof(flat_texture);
+		case materials:
+			return sizeof(flat_material);
+		case spheres:
+			return sizeof(flat_sphere);
+		case quads:
+			return sizeof(flat_quad);
+		case triangles:
+			return sizeof(flat_triangle);
+		case media:
+			return sizeof(flat_medium);
+		case dependencies:
+			return sizeof(flat_dependency);
+		case nodes:
+			return sizeof(linear_bvh_node);
+		case strings:
+			return 1;
+		default:
+			return sizeof(uint32_t);
+		}
+	}
+
+	static uint32_t record_layout()
+	{
+		uint64_t h = 0;
+		for (size_t size : {sizeof(scene_cache_header), sizeof(flat_texture), sizeof(flat_material), sizeof(flat_sphere),
+							sizeof(flat_quad), sizeof(flat_triangle), sizeof(flat_medium), sizeof(flat_dependency),
+							sizeof(linear_bvh_node)})
+			h = mix_bits(h ^ size);
+		return uint32_t(h);
+	}
+};
+
+// A read-only mapping of a whole file.
+class mapped_file
+{
+public:
+	explicit mapped_file(const std::string &path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+						   nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+			return;
+		void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!view)
+			return;
+		bytes = static_cast<const char *>(view);
+		length = size_t(file_size.QuadPart);
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view != MAP_FAILED)
+			{
+				bytes = static_cast<const char *>(view);
+				length = size_t(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	~mapped_file()
+	{
+#ifdef _WIN32
+		if (bytes)
+			UnmapViewOfFile(bytes);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (bytes)
+			munmap(const_cast<char *>(bytes), length);
+#endif
+	}
+
+	const char *data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const char *bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// Whether the records of a cache, whose sections are known to lie inside it, only refer to what
+// exists: indices within their arrays, strings terminated, BVH nodes within the tree and not too
+// deep for traversal's stack. This is checked once, when the cache is written: scanning every
+// record on each load would make a warm start grow with the size of the scene.
+inline bool valid_scene_cache(const scene_cache_header &header, const char *base)
+{
+	using h = scene_cache_header;
+	auto count = [&](h::section_t s) { return size_t(header.sections[s].count); };
+	auto array = [&](h::section_t s) { return base + header.sections[s].offset; };
+
+	size_t string_bytes = count(h::strings);
+	const char *strings = array(h::strings);
+	if (string_bytes > 0 && strings[string_bytes - 1] != '\0')
+		return false;
+
+	size_t vertex_count = count(h::vertices);
+	for (uint32_t a = 1; a < vertex_attribute_count; a++)
+		if (count(h::section_t(h::vertices + a)) != vertex_count)
+			return false;
+
+	size_t texture_count = count(h::textures), material_count = count(h::materials);
+	const auto *textures = reinterpret_cast<const flat_texture *>(array(h::textures));
+	for (size_t k = 0; k < texture_count; k++)
+	{
+		const flat_texture &t = textures[k];
+		// a checker or blend refers to textures made before it
+		if (t.kind > flat_texture::blend ||
+			((t.kind == flat_texture::checker || t.kind == flat_texture::blend) && (t.even >= k || t.odd >= k)) ||
+			(t.kind == flat_texture::image && t.name >= string_bytes))
+			return false;
+	}
+	const auto *materials = reinterpret_cast<const flat_material *>(array(h::materials));
+	for (size_t k = 0; k < material_count; k++)
+	{
+		const flat_material &m = materials[k];
+		bool textured = m.kind == flat_material::lambertian || m.kind == flat_material::light ||
+						m.kind == flat_material::isotropic;
+		if (m.kind > flat_material::isotropic || (textured && m.texture >= texture_count))
+			return false;
+	}
+	auto valid_material = [&](uint32_t m) { return m == flat_none || m < material_count; };
+
+	const auto *spheres = reinterpret_cast<const flat_sphere *>(array(h::spheres));
+	for (size_t k = 0; k < count(h::spheres); k++)
+		if (!valid_material(spheres[k].material))
+			return false;
+	const auto *quads = reinterpret_cast<const flat_quad *>(array(h::quads));
+	for (size_t k = 0; k < count(h::quads); k++)
+		if (!valid_material(quads[k].material))
+			return false;
+	const auto *triangles = reinterpret_cast<const flat_triangle *>(array(h::triangles));
+	for (size_t k = 0; k < count(h::triangles); k++)
+	{
+		const flat_triangle &t = triangles[k];
+		if (!valid_material(t.material) || t.v[0] >= vertex_count || t.v[1] >= vertex_count || t.v[2] >= vertex_count)
+			return false;
+	}
+
+	// primitive ids; a medium's boundary may only hold media before it, so there are no cycles
+	auto valid_id = [&](uint32_t id, size_t media_before)
+	{
+		size_t index = flat_index_of(id);
+		switch (flat_kind_of(id))
+		{
+		case flat_sphere_kind:
+			return index < count(h::spheres);
+		case flat_quad_kind:
+			return index < count(h::quads);
+		case flat_triangle_kind:
+			return index < count(h::triangles);
+		default:
+			return index < media_before;
+		}
+	};
+	size_t medium_count = count(h::media), medium_id_count = count(h::medium_ids);
+	const auto *media = reinterpret_cast<const flat_medium *>(array(h::media));
+	const auto *medium_ids = reinterpret_cast<const uint32_t *>(array(h::medium_ids));
+	for (size_t k = 0; k < medium_count; k++)
+	{
+		const flat_medium &m = media[k];
+		if (m.texture >= texture_count || m.first > medium_id_count || m.count > medium_id_count - m.first)
+			return false;
+		for (uint32_t i = m.first; i < m.first + m.count; i++)
+			if (!valid_id(medium_ids[i], k))
+				return false;
+	}
+	const auto *lights = reinterpret_cast<const uint32_t *>(array(h::lights));
+	for (size_t k = 0; k < count(h::lights); k++)
+		if (!valid_id(lights[k], medium_count))
+			return false;
+	size_t slot_count = count(h::slots);
+	const auto *slots = reinterpret_cast<const uint32_t *>(array(h::slots));
+	for (size_t k = 0; k < slot_count; k++)
+		if (!valid_id(slots[k], medium_count))
+			return false;
+	const auto *dependencies = reinterpret_cast<const flat_dependency *>(array(h::dependencies));
+	for (size_t k = 0; k < count(h::dependencies); k++)
+		if (dependencies[k].name >= string_bytes)
+			return false;
+
+	// nodes are depth first, so children come after their parent and depths can be found in order
+	size_t node_count = count(h::nodes);
+	const auto *nodes = reinterpret_cast<const linear_bvh_node *>(array(h::nodes));
+	std::vector<uint8_t> depth(node_count, 0);
+	for (size_t k = 0; k < node_count; k++)
+	{
+		const linear_bvh_node &n = nodes[k];
+		if (n.is_leaf())
+		{
+			if (n.offset > slot_count || n.count > slot_count - n.offset)
+				return false;
+			continue;
+		}
+		if (n.axis > 2 || k + 1 >= node_count || n.offset <= k + 1 || n.offset >= node_count || depth[k] >= 63)
+			return false;
+		depth[k + 1] = std::max<uint8_t>(depth[k + 1], depth[k] + 1);
+		depth[n.offset] = std::max<uint8_t>(depth[n.offset], depth[k] + 1);
+	}
+	return true;
+}
+
+// Hash n bytes at p into h.
+inline uint64_t checksum_bytes(uint64_t h, const char *p, size_t n)
+{
+	for (size_t k = 0; k < n; k += 8)
+	{
+		uint64_t word = 0;
+		std::memcpy(&word, p + k, std::min<size_t>(8, n - k));
+		h = mix_bits(h ^ word);
+	}
+	return mix_bits(h ^ n);
+}
+
+// The checksum of a cache: of its header, with the checksum itself taken as 0, and of the sections
+// the loader turns into objects, which are small. The primitives, vertices and BVH, which hold
+// nearly all of the bytes, are left out so that loading stays independent of the scene's size;
+// the writer validated them, and replaces the cache whole, so only a file damaged on disk or
+// edited by hand could have them wrong.
+inline uint64_t scene_cache_checksum(const char *base)
+{
+	using h = scene_cache_header;
+	char header_bytes[sizeof(h)];
+	std::memcpy(header_bytes, base, sizeof header_bytes);
+	std::memset(header_bytes + offsetof(h, checksum), 0, sizeof(uint64_t));
+	h header;
+	std::memcpy(&header, header_bytes, sizeof header);
+	uint64_t sum = checksum_bytes(0, header_bytes, sizeof header_bytes);
+	for (h::section_t s : {h::textures, h::materials, h::media, h::medium_ids, h::lights, h::dependencies, h::strings})
+		sum = checksum_bytes(sum, base + header.sections[s].offset, header.sections[s].count * h::element_size(s));
+	return sum;
+}
+
+// Build the BVH over the scene's primitives and write the cache for it to path. Primitives are
+// stored in the order the leaves reference them, so a leaf's shapes sit next to each other.
+inline bool write_scene_cache(const std::string &path, uint64_t source_key, const flat_scene_data &data,
+							  const camera &cam)
+{
+	flat_geometry geometry;
+	geometry.spheres = data.spheres.data();
+	geometry.quads = data.quads.data();
+	geometry.triangles = data.triangles.data();
+	for (uint32_t a = 0; a < vertex_attribute_count; a++)
+		geometry.vertices[a] = data.vertices[a].data();
+	geometry.media = data.media.data();
+	geometry.medium_ids = data.medium_ids.data();
+
+	std::vector<aabb> boxes(data.world.size());
+	for (size_t k = 0; k < boxes.size(); k++)
+		boxes[k] = geometry.bounds(data.world[k]);
+	linear_bvh tree;
+	tree.build(boxes);
+
+	// copy the primitives into 'packed' as the leaves reach them
+	flat_scene_data packed;
+	auto pack = [&](uint32_t id, auto &self) -> uint32_t
+	{
+		uint32_t index = flat_index_of(id);
+		switch (flat_kind_of(id))
+		{
+		case flat_sphere_kind:
+			packed.spheres.push_back(data.spheres[index]);
+			return flat_id(flat_sphere_kind, packed.spheres.size() - 1);
+		case flat_quad_kind:
+			packed.quads.push_back(data.quads[index]);
+			return flat_id(flat_quad_kind, packed.quads.size() - 1);
+		case flat_triangle_kind:
+			packed.triangles.push_back(data.triangles[index]);
+			return flat_id(flat_triangle_kind, packed.triangles.size() - 1);
+		default:
+		{
+			const flat_medium &m = data.media[index];
+			std::vector<uint32_t> boundary;
+			for (uint32_t k = m.first; k < m.first + m.count; k++)
+				boundary.push_back(self(data.medium_ids[k], self));
+			return packed.add_medium(boundary, m.density, m.texture);
+		}
+		}
+	};
+	std::vector<uint32_t> slots(tree.indices.size());
+	for (size_t slot = 0; slot < slots.size(); slot++)
+		slots[slot] = pack(data.world[tree.indices[slot]], pack);
+	for (uint32_t id : data.lights)
+		packed.lights.push_back(pack(id, pack));
+
+	scene_cache_header header;
+	header.layout = scene_cache_header::record_layout();
+	header.source_key = source_key;
+	header.camera = scene_cache_camera{cam.image_width, cam.samples_per_pixel, cam.max_depth, cam.min_depth,
+									   cam.aspect_ratio, cam.vfov, cam.defocus_angle, cam.focus_dist,
+									   cam.lookfrom, cam.lookat, cam.vup, cam.background};
+
+	std::string bytes(sizeof header, '\0');
+	auto add = [&](scene_cache_header::section_t s, const void *p, size_t count, size_t element_size)
+	{
+		bytes.resize((bytes.size() + 63) / 64 * 64, '\0');
+		header.sections[s] = {bytes.size(), count};
+		bytes.append(static_cast<const char *>(p), count * element_size);
+	};
+	add(scene_cache_header::textures, data.textures.data(), data.textures.size(), sizeof(flat_texture));
+	add(scene_cache_header::materials, data.materials.data(), data.materials.size(), sizeof(flat_material));
+	add(scene_cache_header::spheres, packed.spheres.data(), packed.spheres.size(), sizeof(flat_sphere));
+	add(scene_cache_header::quads, packed.quads.data(), packed.quads.size(), sizeof(flat_quad));
+	add(scene_cache_header::triangles, packed.triangles.data(), packed.triangles.size(), sizeof(flat_triangle));
+	for (uint32_t a = 0; a < vertex_attribute_count; a++)
+		add(scene_cache_header::section_t(scene_cache_header::vertices + a), data.vertices[a].data(),
+			data.vertices[a].size(), sizeof(double));
+	add(scene_cache_header::media, packed.media.data(), packed.media.size(), sizeof(flat_medium));
+	add(scene_cache_header::medium_ids, packed.medium_ids.data(), packed.medium_ids.size(), sizeof(uint32_t));
+	add(scene_cache_header::lights, packed.lights.data(), packed.lights.size(), sizeof(uint32_t));
+	add(scene_cache_header::dependencies, data.dependencies.data(), data.dependencies.size(), sizeof(flat_dependency));
+	add(scene_cache_header::nodes, tree.nodes.data(), tree.nodes.size(), sizeof(linear_bvh_node));
+	add(scene_cache_header::slots, slots.data(), slots.size(), sizeof(uint32_t));
+	add(scene_cache_header::strings, data.strings.data(), data.strings.size(), 1);
+	header.file_size = bytes.size();
+	if (!valid_scene_cache(header, bytes.data()))
+		return false;
+	std::memcpy(&bytes[0], &header, sizeof header);
+	header.checksum = scene_cache_checksum(bytes.data());
+	std::memcpy(&bytes[0], &header, sizeof header);
+
+	// write a temporary file and move it over path, so a reader never maps a partial cache
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary);
+		if (!out.write(bytes.data(), std::streamsize(bytes.size())).flush())
+			return false;
+	}
+	if (std::rename(temp.c_str(), path.c_str()) == 0)
+		return true;
+	std::remove(path.c_str());
+	return std::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+// Map the cache at path into out if it was made from a scene file with the given source key.
+// Fails quietly when there is no usable cache, so the caller can fall back to the scene file.
+inline bool load_scene_cache(const std::string &path, uint64_t source_key, scene &out)
+{
+	auto file = make_shared<mapped_file>(path);
+	const char *base = file->data();
+	if (!base || file->size() < sizeof(scene_cache_header))
+		return false;
+
+	scene_cache_header header;
+	std::memcpy(&header, base, sizeof header);
+	if (std::memcmp(header.magic, scene_cache_header().magic, sizeof header.magic) != 0 || header.version != scene_cache_header().version ||
+		header.layout != scene_cache_header::record_layout() || header.source_key != source_key ||
+		header.file_size != file->size())
+		return false;
+
+	for (int s = 0; s < scene_cache_header::section_count; s++)
+	{
+		const auto &section = header.sections[s];
+		if (section.offset % 64 != 0 || section.offset > header.file_size ||
+			section.count > (header.file_size - section.offset) / scene_cache_header::element_size(s))
+			return false;
+	}
+	if (header.sections[scene_cache_header::nodes].count == 0 || header.checksum != scene_cache_checksum(base))
+		return false;
+
+	auto array = [&](scene_cache_header::section_t s)
+	{ return base + header.sections[s].offset; };
+	auto count = [&](scene_cache_header::section_t s)
+	{ return size_t(header.sections[s].count); };
+
+	const auto *texture_records = reinterpret_cast<const flat_texture *>(array(scene_cache_header::textures));
+	const auto *material_records = reinterpret_cast<const flat_material *>(array(scene_cache_header::materials));
+	const char *strings = array(scene_cache_header::strings);
+
+	// a mesh or other file read into the cache changed since; the files key the scene as
+	// load_scene() keys it
+	uint64_t scene_key = source_key;
+	const auto *dependencies = reinterpret_cast<const flat_dependency *>(array(scene_cache_header::dependencies));
+	for (size_t k = 0; k < count(scene_cache_header::dependencies); k++)
+	{
+		const flat_dependency &d = dependencies[k];
+		if (file_source_key(strings + d.name) != d.key)
+			return false;
+		scene_key = mix_bits(scene_key ^ d.key);
+	}
+
+	std::vector<shared_ptr<texture>> textures;
+	for (size_t k = 0; k < count(scene_cache_header::textures); k++)
+		textures.push_back(make_texture(texture_records[k], textures, strings));
+	std::vector<shared_ptr<material>> materials;
+	for (size_t k = 0; k < count(scene_cache_header::materials); k++)
+		materials.push_back(make_material(material_records[k], textures));
+
+	flat_geometry geometry;
+	geometry.spheres = reinterpret_cast<const flat_sphere *>(array(scene_cache_header::spheres));
+	geometry.quads = reinterpret_cast<const flat_quad *>(array(scene_cache_header::quads));
+	geometry.triangles = reinterpret_cast<const flat_triangle *>(array(scene_cache_header::triangles));
+	for (uint32_t a = 0; a < vertex_attribute_count; a++)
+		geometry.vertices[a] = reinterpret_cast<const double *>(array(scene_cache_header::section_t(scene_cache_header::vertices + a)));
+	geometry.media = reinterpret_cast<const flat_medium *>(array(scene_cache_header::media));
+	geometry.medium_ids = reinterpret_cast<const uint32_t *>(array(scene_cache_header::medium_ids));
+	auto world = make_shared<flat_scene>(geometry, reinterpret_cast<const linear_bvh_node *>(array(scene_cache_header::nodes)),
+										 reinterpret_cast<const uint32_t *>(array(scene_cache_header::slots)),
+										 count(scene_cache_header::media), textures, materials, file);
+
+	// lights are sampled through their own objects, made without materials like the parser's
+	out.lights = hittable_list();
+	const auto *lights = reinterpret_cast<const uint32_t *>(array(scene_cache_header::lights));
+	for (size_t k = 0; k < count(scene_cache_header::lights); k++)
+	{
+		uint32_t index = flat_index_of(lights[k]);
+		if (flat_kind_of(lights[k]) == flat_sphere_kind)
+		{
+			const flat_sphere &s = geometry.spheres[index];
+			if (s.motion.length_squared() > 0)
+				out.lights.add(make_shared<sphere>(s.center, s.center + s.motion, s.radius, nullptr));
+			else
+				out.lights.add(make_shared<sphere>(s.center, s.radius, nullptr));
+		}
+		else if (flat_kind_of(lights[k]) == flat_quad_kind)
+		{
+			const flat_quad &q = geometry.quads[index];
+			out.lights.add(make_shared<quad>(q.Q, q.u, q.v, nullptr));
+		}
+	}
+	out.world = hittable_list(world);
+
+	const scene_cache_camera &c = header.camera;
+	camera &cam = out.cam;
+	cam.scene_key = scene_key;
+	cam.image_width = c.width;
+	cam.samples_per_pixel = c.spp;
+	cam.max_depth = c.max_depth;
+	cam.min_depth = c.min_depth;
+	cam.aspect_ratio = c.aspect;
+	cam.vfov = c.vfov;
+	cam.defocus_angle = c.defocus_angle;
+	cam.focus_dist = c.focus_dist;
+	cam.lookfrom = c.lookfrom;
+	cam.lookat = c.lookat;
+	cam.vup = c.vup;
+	cam.background = c.background;
+	out.shape_count = count(scene_cache_header::slots);
+	return true;
+}
+
+// Load the scene file at scene_path through the cache at cache_path: map the cache if it is
+// current, otherwise parse the scene and write a new cache first. parse_seconds and bvh_seconds
+// of out cover the parsing and building, if any, and cache_seconds the mapping.
+inline bool load_scene_cached(const std::string &scene_path, const std::string &cache_path, scene &out,
+							  double &cache_seconds, bool &cache_hit)
+{
+	uint64_t key = file_source_key(scene_path);
+	if (key == 0)
+	{
+		std::cerr << "ERROR: Could not open the scene '" << scene_path << "'.\n";
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	cache_hit = load_scene_cache(cache_path, key, out);
+	if (!cache_hit)
+	{
+		flat_scene_data data;
+		scene parsed;
+		std::ifstream in(scene_path);
+		if (!scene_parser(parsed, &data).parse(in, scene_path))
+			return false;
+		out.parse_seconds = parsed.parse_seconds;
+
+		auto bvh_start = std::chrono::steady_clock::now();
+		if (!write_scene_cache(cache_path, key, data, parsed.cam))
+		{
+			std::cerr << "ERROR: Could not write the scene cache '" << cache_path << "'.\n";
+			return false;
+		}
+		out.bvh_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count();
+
+		start = std::chrono::steady_clock::now();
+		if (!load_scene_cache(cache_path, key, out))
+		{
+			std::cerr << "ERROR: Could not load the scene cache '" << cache_path << "'.\n";
+			return false;
+		}
+	}
+	cache_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+// a rectangular block of pixels [x0,x1) x [y0,y1)
+struct tile
+{
+	int x0, y0, x1, y1;
+
+	int pixel_count() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// how long one tile took and which thread rendered it
+struct tile_timing
+{
+	tile t;
+	int thread;
+	double seconds;
+};
+
+// Splits the image into square tiles and renders them on a pool of threads with work stealing.
+// Every thread starts with a contiguous run of tiles in its own queue and takes work from the
+// front of it; once a thread runs dry it steals from the back of another thread's queue, so a
+// few expensive tiles can't leave the other threads idle at the end of the frame.
+class tile_scheduler
+{
+public:
+	int num_threads = 0; // 0 uses omp_get_max_threads(), i.e. OMP_NUM_THREADS or the hardware thread count
+	int tile_size = 32;	 // tile edge length in pixels
+
+	// call render_tile(const tile&) once for every tile covering a width x height image
+	template <typename F>
+	void run(int width, int height, F &&render_tile)
+	{
+		std::vector<tile> tiles = make_tiles(width, height);
+		int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+		threads = std::max(1, std::min(threads, int(tiles.size())));
+
+		std::vector<worker_queue> queues(threads);
+		for (int t = 0; t < threads; t++)
+		{
+			size_t begin = tiles.size() * t / threads;
+			size_t end = tiles.size() * (t + 1) / threads;
+			for (size_t k = begin; k < end; k++)
+				queues[t].tiles.push_back(int(k));
+		}
+
+		timings.assign(tiles.size(), tile_timing{});
+		thread_busy.assign(threads, 0.0);
+		steals = 0;
+		std::atomic<int> remaining(int(tiles.size()));
+		auto frame_start = clock::now();
+
+#pragma omp parallel num_threads(threads)
+		{
+			int self = omp_get_thread_num();
+			int index;
+			while (next_tile(queues, self, index))
+			{
+				auto start = clock::now();
+				render_tile(tiles[index]);
+				double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+				timings[index] = tile_timing{tiles[index], self, seconds};
+				thread_busy[self] += seconds;
+
+				int left = --remaining;
+#pragma omp critical(tile_progress)
+				std::clog << "\rTiles remaining: " << left << "    " << std::flush;
+			}
+		}
+
+		frame_seconds = std::chrono::duration<double>(clock::now() - frame_start).count();
+	}
+
+	// per-tile render times of the last run, in tile order (row-major)
+	const std::vector<tile_timing> &tile_timings() const { return timings; }
+
+	// print a summary of how evenly the last run was spread over the threads
+	void report(std::ostream &out) const
+	{
+		if (timings.empty())
+			return;
+
+		double slowest = 0, total = 0;
+		for (const auto &t : timings)
+		{
+			slowest = std::max(slowest, t.seconds);
+			total += t.seconds;
+		}
+		double busiest = *std::max_element(thread_busy.begin(), thread_busy.end());
+		double idlest = *std::min_element(thread_busy.begin(), thread_busy.end());
+		double mean_busy = total / thread_busy.size();
+
+		out << timings.size() << " tiles of " << tile_size << "x" << tile_size << " on "
+			<< thread_busy.size() << " threads in " << frame_seconds << "s, " << steals << " steals\n"
+			<< "  tile time: mean " << total / timings.size() << "s, max " << slowest << "s\n"
+			<< "  thread busy time: min " << idlest << "s, max " << busiest << "s, balance "
+			<< (busiest > 0 ? mean_busy / busiest : 1.0) << '\n';
+	}
+
+	// write one line per tile (x0,y0,x1,y1,thread,seconds) so the timings can be plotted as a heatmap
+	bool write_timings(const std::string &path) const
+	{
+		std::ofstream out(path);
+		if (!out)
+			return false;
+
+		out << "x0,y0,x1,y1,thread,seconds\n";
+		for (const auto &t : timings)
+			out << t.t.x0 << ',' << t.t.y0 << ',' << t.t.x1 << ',' << t.t.y1 << ',' << t.thread << ',' << t.seconds << '\n';
+		return true;
+	}
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	// a thread's own tiles, padded to a cache line so neighbouring queues don't false-share
+	struct alignas(64) worker_queue
+	{
+		std::mutex lock;
+		std::deque<int> tiles;
+	};
+
+	std::vector<tile_timing> timings;
+	std::vector<double> thread_busy;
+	std::atomic<int> steals{0};
+	double frame_seconds = 0;
+
+	std::vector<tile> make_tiles(int width, int height) const
+	{
+		int size = std::max(1, tile_size);
+		std::vector<tile> tiles;
+		for (int y = 0; y < height; y += size)
+			for (int x = 0; x < width; x += size)
+				tiles.push_back(tile{x, y, std::min(x + size, width), std::min(y + size, height)});
+		return tiles;
+	}
+
+	// pop the next tile from our own queue, or steal one from the back of another thread's queue
+	bool next_tile(std::vector<worker_queue> &queues, int self, int &index)
+	{
+		{
+			std::lock_guard<std::mutex> guard(queues[self].lock);
+			if (!queues[self].tiles.empty())
+			{
+				index = queues[self].tiles.front();
+				queues[self].tiles.pop_front();
+				return true;
+			}
+		}
+
+		int n = int(queues.size());
+		for (int k = 1; k < n; k++)
+		{
+			auto &victim = queues[(self + k) % n];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tiles.empty())
+			{
+				index = victim.tiles.back();
+				victim.tiles.pop_back();
+				steals++;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+#endif
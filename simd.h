@@ -0,0 +1,41 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// What the x86 SIMD kernels need: the intrinsics, a way to compile a function for AVX2 in a build
+// that doesn't target it, and a check at run time that the CPU can run such a function.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// true if the CPU and OS support AVX2, checked once
+inline bool cpu_has_avx2()
+{
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+	static const bool avx2 = []
+	{
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+	}();
+	return avx2;
+#else
+	return false;
+#endif
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material_table.h"
 #include "onb.h"
 
 class sphere : public hittable
@@ -9,7 +10,7 @@ class sphere : public hittable
 private:
 	point3 center1;
 	double radius;
-	std::shared_ptr<material> mat;
+	const material *mat; // owned by material_table
 	bool is_moving;
 	vec3 center_vec;
 	aabb bbox;
@@ -20,6 +21,18 @@ private:
 		return center1 + time * center_vec;
 	}
 
+	// fill in the hit record for a hit at distance root along r
+	void set_hit_record(const ray &r, double root, const point3 &center, hit_record &rec) const
+	{
+		rec.t = root;		 // the t value of intersection point
+		rec.p = r.at(rec.t); // intersection point
+		vec3 outward_normal = (rec.p - center) / radius;
+		rec.set_face_normal(r, outward_normal);
+		rec.mat = mat; // the material of intersection point
+		get_sphere_uv(outward_normal, rec.u, rec.v);
+		rec.uv_scale = 1 / (pi * radius); // v runs over half a great circle
+	}
+
 	static vec3 random_to_sphere(double radius, double distance_squared) {
 		auto r1 = random_double();
 		auto r2 = random_double();
@@ -34,14 +47,14 @@ private:
 
 public:
 	// Stationary Sphere
-	sphere(const point3 &center, const double &radius, std::shared_ptr<material> mat) : center1(center), radius(fmax(0, radius)), mat(mat), is_moving(false)
+	sphere(const point3 &center, const double &radius, std::shared_ptr<material> mat) : center1(center), radius(fmax(0, radius)), mat(material_table::global().add(mat)), is_moving(false)
 	{
 		auto rvec = vec3(radius, radius, radius);
 		bbox = aabb(center1 - rvec, center1 + rvec);
 	}
 
 	// Moving Sphere
-	sphere(const point3 &center1, const point3 &center2, double radius, std::shared_ptr<material> mat) : center1(center1), radius(fmax(0, radius)), mat(mat), is_moving(true)
+	sphere(const point3 &center1, const point3 &center2, double radius, std::shared_ptr<material> mat) : center1(center1), radius(fmax(0, radius)), mat(material_table::global().add(mat)), is_moving(true)
 	{
 		center_vec = center2 - center1;
 
@@ -56,6 +69,17 @@ public:
 	{
 		// determin the center
 		point3 center = is_moving ? sphere_center(r.time()) : center1;
+		double root;
+		if (!intersect(r, ray_t, center, radius, root))
+			return false;
+
+		set_hit_record(r, root, center, rec);
+		return true;
+	}
+
+	// the nearest distance along r inside ray_t at which it meets the sphere, if it does
+	static bool intersect(const ray &r, interval ray_t, const point3 &center, double radius, double &root)
+	{
 		vec3 oc = center - r.origin();
 		auto a = r.direction().length_squared();
 		auto h = dot(r.direction(), oc);
@@ -68,24 +92,62 @@ public:
 		auto sqrtd = sqrt(discriminant);
 
 		// Find the nearest root that lies in the acceptable range.
-		auto root = (h - sqrtd) / a;
+		root = (h - sqrtd) / a;
 		if (!ray_t.surrounds(root))
 		{
 			root = (h + sqrtd) / a;
 			if (!ray_t.contains(root))
 				return false;
 		}
+		return true;
+	}
 
-		// ཻhit_recordֵ
-		rec.t = root;		 // the t value of intersection point
-		rec.p = r.at(rec.t); // intersection point
-		vec3 outward_normal = (rec.p - center) / radius;
-		rec.set_face_normal(r, outward_normal);
-		rec.mat = mat; // the material of intersection point
-		// ? Ϊʲô normal
-		get_sphere_uv(outward_normal, rec.u, rec.v); // £uv
+	// the same test as hit() for a whole packet: the quadratic is solved for all lanes in one
+	// SIMD loop, only the hit records of the lanes that hit are filled in one by one
+	uint32_t hit_packet(ray_packet &packet, uint32_t active, hit_record *recs) const override
+	{
+		const int n = ray_packet::max_size;
+		double oc[3][n], roots[n], found[n];
 
-		return true;
+		for (int a = 0; a < 3; a++)
+		{
+#pragma omp simd
+			for (int k = 0; k < packet.size; k++)
+				oc[a][k] = (is_moving ? center1[a] + packet.time[k] * center_vec[a] : center1[a]) - packet.org[a][k];
+		}
+
+		// lanes that miss compute garbage roots, the conditions are combined with & and | so
+		// the loop has no branches
+#pragma omp simd
+		for (int k = 0; k < packet.size; k++)
+		{
+			double dx = packet.dir[0][k], dy = packet.dir[1][k], dz = packet.dir[2][k];
+			double a = dx * dx + dy * dy + dz * dz;
+			double h = dx * oc[0][k] + dy * oc[1][k] + dz * oc[2][k];
+			double c = (oc[0][k] * oc[0][k] + oc[1][k] * oc[1][k] + oc[2][k] * oc[2][k]) - radius * radius;
+
+			double discriminant = h * h - a * c;
+			double sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+			double near_root = (h - sqrtd) / a;
+			double far_root = (h + sqrtd) / a;
+			bool near_ok = (packet.t_min[k] < near_root) & (near_root < packet.t_max[k]);
+			bool far_ok = (packet.t_min[k] <= far_root) & (far_root <= packet.t_max[k]);
+
+			roots[k] = near_ok ? near_root : far_root;
+			found[k] = (discriminant >= 0) & (near_ok | far_ok) ? 1.0 : 0.0;
+		}
+
+		uint32_t hits = lane_mask(found, packet.size) & active;
+		for (uint32_t mask = hits; mask; mask &= mask - 1)
+		{
+			int k = 0;
+			while (!(mask & (1u << k)))
+				k++;
+			const ray &r = packet.rays[k];
+			set_hit_record(r, roots[k], is_moving ? sphere_center(r.time()) : center1, recs[k]);
+			packet.t_max[k] = roots[k];
+		}
+		return hits;
 	}
 
 	// ʵ virtual 
@@ -0,0 +1,59 @@
+#include "stats.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation is counted into the calling thread's stats by replacing the global
+// operator new. The replacements live in this file alone, so they are defined once however many
+// files include stats.h. The array, nothrow and sized forms the library provides all forward to
+// these.
+
+namespace
+{
+	void *allocate(std::size_t size, std::size_t alignment)
+	{
+		thread_stats().allocations++;
+		if (size == 0)
+			size = 1;
+		void *p;
+		if (alignment <= alignof(std::max_align_t))
+			p = std::malloc(size);
+		else
+#ifdef _MSC_VER
+			p = _aligned_malloc(size, alignment);
+#else
+			p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void release_aligned(void *p, std::size_t alignment)
+	{
+		if (alignment <= alignof(std::max_align_t))
+			std::free(p);
+		else
+#ifdef _MSC_VER
+			_aligned_free(p);
+#else
+			std::free(p);
+#endif
+	}
+}
+
+void *operator new(std::size_t size) { return allocate(size, 0); }
+
+void *operator new(std::size_t size, std::align_val_t alignment) { return allocate(size, std::size_t(alignment)); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete(void *p, std::align_val_t alignment) noexcept { release_aligned(p, std::size_t(alignment)); }
+
+void operator delete(void *p, std::size_t, std::align_val_t alignment) noexcept
+{
+	release_aligned(p, std::size_t(alignment));
+}
@@ -0,0 +1,42 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <iostream>
+
+// Counters for measuring where render time goes. Every thread counts into its own copy, so
+// counting never contends; the camera folds each thread's counts into the frame total after
+// every tile.
+struct render_stats
+{
+	uint64_t paths = 0;			  // camera samples traced
+	uint64_t rays = 0;			  // rays traced into the scene, primary and scattered
+	uint64_t node_tests = 0;	  // BVH node bounding boxes tested
+	uint64_t primitive_tests = 0; // primitives intersected from BVH leaves
+	uint64_t allocations = 0;	  // heap allocations made while rendering, should stay 0; see stats.cpp
+
+	void add(const render_stats &other)
+	{
+		paths += other.paths;
+		rays += other.rays;
+		node_tests += other.node_tests;
+		primitive_tests += other.primitive_tests;
+		allocations += other.allocations;
+	}
+
+	void report(std::ostream &out) const
+	{
+		double per_ray = rays ? 1.0 / rays : 0.0;
+		out << rays << " rays (" << (paths ? double(rays) / paths : 0.0) << " per path), " << node_tests * per_ray << " BVH node tests and "
+			<< primitive_tests * per_ray << " primitive tests per ray, " << allocations << " heap allocations\n";
+	}
+};
+
+// the calling thread's counters
+inline render_stats &thread_stats()
+{
+	thread_local render_stats stats;
+	return stats;
+}
+
+#endif
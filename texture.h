@@ -4,7 +4,9 @@
 #include "rtweekend.h"
 
 #include "perlin.h"
-#include "rtw_stb_image.h"
+#include "texture_cache.h"
+
+class texture_program;
 
 class texture
 {
@@ -12,6 +14,10 @@ public:
 	virtual ~texture() = default;
 
 	virtual color value(double u, double v, const point3 &p) const = 0;
+
+	// the color averaged over a footprint 'width' across in texture coordinates; textures that
+	// can filter override this, the others ignore the width
+	virtual color value(double u, double v, const point3 &p, double width) const { return value(u, v, p); }
 };
 
 class solid_color : public texture
@@ -27,6 +33,8 @@ public:
 	}
 
 private:
+	friend class texture_program;
+
 	color albedo;
 };
 
@@ -37,31 +45,59 @@ public:
 
 	checker_texture(double scale, const color &c1, const color &c2) : inv_scale(1.0 / scale), even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)) {}
 
-	color value(double u, double v, const point3 &p) const override
+	color value(double u, double v, const point3 &p) const override { return value(u, v, p, 0); }
+
+	color value(double u, double v, const point3 &p, double width) const override
 	{
 		auto xInteger = int(std::floor(inv_scale * p.x()));
 		auto yInteger = int(std::floor(inv_scale * p.y()));
 		auto zInteger = int(std::floor(inv_scale * p.z()));
 
 		bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
-		return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+		return isEven ? even->value(u, v, p, width) : odd->value(u, v, p, width);
 	}
 
 private:
+	friend class texture_program;
+
 	double inv_scale;
 	shared_ptr<texture> even;
 	shared_ptr<texture> odd;
 };
 
+// a fixed mix of two textures: (1 - amount) of the first plus 'amount' of the second
+class blend_texture : public texture
+{
+public:
+	blend_texture(shared_ptr<texture> first, shared_ptr<texture> second, double amount)
+		: first(std::move(first)), second(std::move(second)), amount(amount) {}
+
+	color value(double u, double v, const point3 &p) const override { return value(u, v, p, 0); }
+
+	color value(double u, double v, const point3 &p, double width) const override
+	{
+		return (1 - amount) * first->value(u, v, p, width) + amount * second->value(u, v, p, width);
+	}
+
+private:
+	friend class texture_program;
+
+	shared_ptr<texture> first, second;
+	double amount;
+};
+
 class image_texture : public texture
 {
 public:
-	image_texture(const char *filename) : image(filename) {}
+	// the image is shared with every other texture of the same file, and read lazily
+	image_texture(const char *filename) : image(texture_cache::global().image(filename)) {}
 
-	color value(double u, double v, const point3 &p) const override
+	color value(double u, double v, const point3 &p) const override { return value(u, v, p, 0); }
+
+	color value(double u, double v, const point3 &p, double width) const override
 	{
 		// if we hava no texture data,then return solid cyan as a debugging aid
-		if (image.height() <= 0)
+		if (!image->valid())
 			return color(0, 0.5, 1);
 
 		// clamp input texture coordinates to [0,1] * [1,0]
@@ -69,18 +105,14 @@ public:
 		u = interval(0, 1).clamp(u);
 		v = 1.0 - interval(0, 1).clamp(v); // flip v to image coordinates
 
-		auto i = int(u * image.width());
-		auto j = int(v * image.height());
-
-		auto pixel = image.pixel_data(i, j);
-
-		auto color_scale = 1.0 / 255.0;
-
-		return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+		return image->lookup(u, v, width);
 	}
 
+	// bytes of the image's pages in memory now
+	size_t memory_bytes() const { return image->resident_bytes(); }
+
 private:
-	rtw_image image;
+	shared_ptr<cached_image> image;
 };
 
 class noise_texture : public texture
@@ -89,17 +121,22 @@ class noise_texture : public texture
 public:
 	noise_texture() {}
 
-	noise_texture(double scale) : scale(scale) {}
+	// plain noise at 'scale', or with 'octaves' > 0 marble: stripes along z at 'scale', bent by
+	// that many octaves of turbulence
+	noise_texture(double scale, int octaves = 0) : scale(scale), octaves(octaves) {}
 
 
 	color value(double u, double v, const point3 &p) const override
 	{
-		return color(1, 1, 1) * noise.noise(scale*p);
+		if (octaves > 0)
+			return color(.5, .5, .5) * (1 + sin(scale * p.z() + 10 * noise.turb(p, octaves)));
+		return color(.5, .5, .5) * (1 + noise.noise(scale * p));
 	}
 
 private:
 	perlin noise;
-	double scale;
+	double scale = 1;
+	int octaves = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,446 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "rtweekend.h"
+#include "asset_loader.h"
+#include "mipmap.h"
+#include "rtw_stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
+
+class texture_cache;
+
+// The header of a file of mip pages, followed by the pages of mip_layout(width, height).
+struct tile_file_header
+{
+	char magic[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '\n'};
+	uint32_t version = 1;
+	uint32_t page_bytes = uint32_t(mip_layout::page_bytes);
+	uint64_t source_key = 0; // of the image file the pages were made from
+	int32_t width = 0, height = 0;
+};
+
+// One image of a texture_cache. The first lookup converts the image into a file of mip pages in
+// the cache's directory, unless an up-to-date one is there from an earlier run; after that,
+// pages are read from the file as lookups first touch them.
+class cached_image
+{
+public:
+	cached_image(texture_cache &cache, uint32_t id, std::string name, std::string path)
+		: cache(cache), id(id), name(std::move(name)), path(std::move(path)) {}
+
+	const std::string &file_name() const { return name; }
+
+	// whether the image could be opened; the first call opens it
+	bool valid()
+	{
+		std::call_once(opened, [this] { ok = open(); });
+		return ok;
+	}
+
+	int width() const { return pages.levels.empty() ? 0 : pages.levels[0].width; }
+	int height() const { return pages.levels.empty() ? 0 : pages.levels[0].height; }
+
+	// see mip_layout::lookup; the image must be valid
+	color lookup(double u, double v, double width)
+	{
+		return pages.lookup(u, v, width, [this](int l, int x, int y, unsigned char *rgb) { fetch(l, x, y, rgb); });
+	}
+
+	// bytes of the image's pages in memory now, and of all of them
+	size_t resident_bytes() const { return resident.load(std::memory_order_relaxed) * mip_layout::page_bytes; }
+	size_t total_bytes() const { return pages.page_count * mip_layout::page_bytes; }
+
+private:
+	friend class texture_cache;
+
+	texture_cache &cache;
+	uint32_t id; // in the cache
+	std::string name, path;
+	std::once_flag opened;
+	bool ok = false;
+	mip_layout pages;
+	std::unique_ptr<std::atomic<uint32_t>[]> table; // per page, 1 + the cache slot holding it, 0 if none does
+	std::atomic<uint32_t> resident{0};				// pages in memory
+	std::mutex file_mutex;							// guards file, buffer and read_failed
+	std::string page_path;
+	std::ifstream file;
+	std::vector<unsigned char> buffer; // one page
+	bool read_failed = false;		   // warned about once per image
+
+	bool open();
+	void fetch(int l, int x, int y, unsigned char *rgb);
+	void load(uint32_t page);
+};
+
+// A cache of image textures shared by the whole scene. Each file name is resolved once, however
+// many textures use it. Images are read lazily in 64x64 texel pages (see mip_layout) and the
+// least recently used pages are evicted to stay within a memory budget.
+//
+// Lookups of pages in memory take no lock. A page lives in a slot of a fixed pool, and each slot
+// has a version that is odd while the slot is rewritten: a reader copies its texels, then checks
+// that the version didn't change and the slot still holds its page, and retries if it did (a
+// sequence lock). Slot memory is never freed while the cache exists, so a reader racing an
+// eviction reads stale bytes at worst and then retries. Misses load under a mutex.
+class texture_cache
+{
+public:
+	// the cache image_texture uses
+	static texture_cache &global()
+	{
+		static texture_cache cache;
+		return cache;
+	}
+
+	texture_cache() : directory(default_directory()) {}
+
+	texture_cache(const texture_cache &) = delete;
+	texture_cache &operator=(const texture_cache &) = delete;
+
+	// where the page files go; an image's file is reused as long as the image doesn't change
+	std::filesystem::path directory;
+
+	// whether images are opened on background threads as soon as they are named, rather than
+	// by the first lookup; opening an image decodes it unless its page file is up to date
+	bool preload = true;
+
+	// the most memory pages may take, in bytes; takes effect if set before the first page loads
+	void set_budget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (slots)
+			std::cerr << "WARNING: the texture cache budget can't change once pages are loaded.\n";
+		else
+			budget = bytes;
+	}
+
+	// the image named 'name', looked for as rtw_image looks for images; the same object for the
+	// same name
+	shared_ptr<cached_image> image(const std::string &name)
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		auto it = images.find(name);
+		if (it != images.end())
+			return it->second;
+		std::string path = rtw_image::find(name);
+		if (path.empty())
+			std::cerr << "ERROR: Could not find image file '" << name << "'.\n";
+		auto img = make_shared<cached_image>(*this, uint32_t(owners.size()), name, path);
+		owners.push_back(img.get());
+		images.emplace(name, img);
+		if (preload && !path.empty())
+			loader.submit([img] { img->valid(); });
+		return img;
+	}
+
+	// block until the images named so far are open; returns how long that took
+	double wait_for_loads() { return loader.wait(); }
+
+	// how the background opening of images went
+	void report_loading(std::ostream &out) const
+	{
+		out << loader.jobs_submitted() << " images opened in " << loader.wall_seconds() << " s on "
+			<< loader.threads() << " threads (" << loader.busy_seconds() << " s of work)";
+	}
+
+	// per image, its size and the memory its pages take, then the cache's traffic
+	void report(std::ostream &out)
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (images.empty())
+			return;
+		for (auto &[name, img] : images)
+			out << "  " << name << ": " << img->width() << 'x' << img->height() << ", "
+				<< img->resident_bytes() / 1024.0 << " of " << img->total_bytes() / 1024.0 << " KB in memory\n";
+		const double mb = 1.0 / (1 << 20);
+		out << "texture cache: " << images.size() << " images, " << loads << " pages loaded ("
+			<< loads * mip_layout::page_bytes * mb << " MB), " << evictions << " evicted, peak "
+			<< peak_pages * mip_layout::page_bytes * mb << " MB of a " << budget * mb << " MB budget\n";
+	}
+
+	// identifies the contents of the file at path by its size and modification time, 0 if it
+	// can't be read
+	static uint64_t source_key(const std::string &path)
+	{
+		std::error_code error;
+		auto size = std::filesystem::file_size(path, error);
+		if (error)
+			return 0;
+		auto time = std::filesystem::last_write_time(path, error);
+		if (error)
+			return 0;
+		return mix_bits(mix_bits(size) ^ uint64_t(time.time_since_epoch().count())) | 1;
+	}
+
+private:
+	friend class cached_image;
+
+	struct slot
+	{
+		std::atomic<uint32_t> version{0};  // odd while the slot is rewritten
+		std::atomic<uint64_t> key{0};	   // image id and page held
+		std::atomic<uint32_t> last_use{0}; // the clock when the page was last read
+		unsigned char *data = nullptr;
+	};
+
+	// guards all below but the slots' atomics; lookups of pages in memory never take it
+	std::mutex mutex;
+	size_t budget = size_t(512) << 20;
+	std::map<std::string, shared_ptr<cached_image>> images;
+	std::vector<cached_image *> owners; // by id
+	std::unique_ptr<slot[]> slots;
+	aligned_array<unsigned char> pool; // the slots' pages
+	size_t slot_count = 0;
+	std::vector<uint32_t> free_slots;
+	std::atomic<uint32_t> clock{1}; // ticks once per page loaded
+	uint64_t loads = 0, evictions = 0;
+	size_t resident_pages = 0, peak_pages = 0;
+	// last, so its threads stop before the images they open go away; few threads, as each holds
+	// a whole decoded image while it converts it
+	asset_loader loader{std::min(4, int(std::thread::hardware_concurrency()))};
+
+	static std::filesystem::path default_directory()
+	{
+		std::error_code error;
+		auto temp = std::filesystem::temp_directory_path(error);
+		return (error ? std::filesystem::path(".") : temp) / "rtw_tiles";
+	}
+
+	static uint64_t make_key(uint32_t image, uint32_t page) { return (uint64_t(image) << 32) | page; }
+
+	// The start of the names of the page files of the image at path, whatever their version:
+	// its stem and a hash of its absolute path.
+	std::string page_file_prefix(const std::string &path) const
+	{
+		std::error_code error;
+		auto absolute = std::filesystem::absolute(path, error);
+		char hex[17];
+		std::snprintf(hex, sizeof hex, "%016llx", (unsigned long long)mix_bits(std::hash<std::string>()(absolute.string())));
+		return std::filesystem::path(path).stem().string() + '-' + hex + '-';
+	}
+
+	// where the pages of the image at path, with the given source key, are kept
+	std::string page_file(const std::string &path, uint64_t key) const
+	{
+		char hex[17];
+		std::snprintf(hex, sizeof hex, "%016llx", (unsigned long long)mix_bits(key));
+		return (directory / (page_file_prefix(path) + hex + ".tiles")).string();
+	}
+
+	// delete the page files of earlier versions of the image at path, which nothing will read again
+	void remove_stale_page_files(const std::string &path, const std::string &current) const
+	{
+		std::string prefix = page_file_prefix(path);
+		std::error_code error;
+		for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+		{
+			std::string file = entry.path().filename().string();
+			if (file.compare(0, prefix.size(), prefix) == 0 && entry.path().extension() == ".tiles" &&
+				entry.path() != std::filesystem::path(current))
+				std::filesystem::remove(entry.path(), error);
+		}
+	}
+
+	// copy the 3 bytes at 'offset' of the page in slot s, if the slot still holds the page 'key'
+	bool read(uint32_t s, uint64_t key, size_t offset, unsigned char *rgb)
+	{
+		slot &sl = slots[s];
+		uint32_t before = sl.version.load(std::memory_order_acquire);
+		if ((before & 1) || sl.key.load(std::memory_order_relaxed) != key)
+			return false;
+		std::memcpy(rgb, sl.data + offset, 3);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sl.version.load(std::memory_order_relaxed) != before)
+			return false;
+		// most reads find the stamp current, and so leave its cache line unwritten
+		uint32_t now = clock.load(std::memory_order_relaxed);
+		if (sl.last_use.load(std::memory_order_relaxed) != now)
+			sl.last_use.store(now, std::memory_order_relaxed);
+		return true;
+	}
+
+	// put page 'page' of img, whose bytes are given, into a slot, unless another thread did
+	void store(cached_image &img, uint32_t page, const unsigned char *bytes)
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (img.table[page].load(std::memory_order_relaxed) != 0)
+			return;
+
+		uint32_t s = take_slot();
+		slot &sl = slots[s];
+		uint32_t version = sl.version.load(std::memory_order_relaxed);
+		sl.version.store(version + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		sl.key.store(make_key(img.id, page), std::memory_order_relaxed);
+		std::memcpy(sl.data, bytes, mip_layout::page_bytes);
+		sl.last_use.store(clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		sl.version.store(version + 2, std::memory_order_release);
+		img.table[page].store(s + 1, std::memory_order_release);
+
+		img.resident.fetch_add(1, std::memory_order_relaxed);
+		loads++;
+		peak_pages = std::max(peak_pages, ++resident_pages);
+	}
+
+	uint32_t take_slot()
+	{
+		if (!slots)
+		{
+			// a trilinear lookup touches at most 8 pages
+			slot_count = std::max<size_t>(budget / mip_layout::page_bytes, 8);
+			slots.reset(new slot[slot_count]);
+			pool = make_aligned_array<unsigned char>(slot_count * mip_layout::page_bytes);
+			for (size_t s = 0; s < slot_count; s++)
+				slots[s].data = pool.get() + s * mip_layout::page_bytes;
+			for (size_t s = slot_count; s-- > 0;)
+				free_slots.push_back(uint32_t(s));
+		}
+		if (free_slots.empty())
+			evict();
+		uint32_t s = free_slots.back();
+		free_slots.pop_back();
+		return s;
+	}
+
+	// free the least recently used sixteenth of the slots, all of which are taken
+	void evict()
+	{
+		std::vector<uint32_t> order(slot_count);
+		std::iota(order.begin(), order.end(), 0);
+		size_t count = std::max<size_t>(1, slot_count / 16);
+		std::nth_element(order.begin(), order.begin() + (count - 1), order.end(), [this](uint32_t a, uint32_t b)
+						 { return slots[a].last_use.load(std::memory_order_relaxed) < slots[b].last_use.load(std::memory_order_relaxed); });
+		for (size_t k = 0; k < count; k++)
+		{
+			// the slot keeps its bytes and key until it is reused, so readers still holding it
+			// read what they expect
+			uint64_t key = slots[order[k]].key.load(std::memory_order_relaxed);
+			cached_image *owner = owners[key >> 32];
+			owner->table[uint32_t(key)].store(0, std::memory_order_relaxed);
+			owner->resident.fetch_sub(1, std::memory_order_relaxed);
+			free_slots.push_back(order[k]);
+		}
+		evictions += count;
+		resident_pages -= count;
+	}
+};
+
+inline bool cached_image::open()
+{
+	if (path.empty())
+		return false;
+
+	// reuse the page file of an earlier run if it was made from this version of the image
+	uint64_t key = texture_cache::source_key(path);
+	page_path = cache.page_file(path, key);
+	tile_file_header header, expected;
+	{
+		// a file cut short would hand out missing pages, so it is made again like a stale one
+		std::ifstream in(page_path, std::ios::binary);
+		std::error_code error;
+		if (!in.read(reinterpret_cast<char *>(&header), sizeof header) ||
+			std::memcmp(header.magic, expected.magic, sizeof header.magic) != 0 || header.version != expected.version ||
+			header.page_bytes != expected.page_bytes || header.source_key != key || header.width <= 0 || header.height <= 0 ||
+			std::filesystem::file_size(page_path, error) !=
+				sizeof header + mip_layout(header.width, header.height).page_count * mip_layout::page_bytes)
+			header.width = 0;
+	}
+	if (header.width == 0)
+	{
+		rtw_image image;
+		if (!image.load(path))
+		{
+			std::cerr << "ERROR: Could not load image file '" << path << "'.\n";
+			return false;
+		}
+		header = expected;
+		header.source_key = key;
+		header.width = image.width();
+		header.height = image.height();
+
+		// write a temporary file and move it over the page file, so no reader sees a partial one
+		std::error_code error;
+		std::filesystem::create_directories(cache.directory, error);
+		std::string temp = page_path + ".tmp";
+		{
+			std::ofstream out(temp, std::ios::binary);
+			out.write(reinterpret_cast<const char *>(&header), sizeof header);
+			out.write(reinterpret_cast<const char *>(image.mips().bytes()), std::streamsize(image.memory_bytes()));
+			if (!out.flush())
+			{
+				std::cerr << "ERROR: Could not write the texture pages '" << temp << "'.\n";
+				return false;
+			}
+		}
+		if (std::rename(temp.c_str(), page_path.c_str()) != 0)
+		{
+			std::remove(page_path.c_str());
+			if (std::rename(temp.c_str(), page_path.c_str()) != 0)
+				return false;
+		}
+		cache.remove_stale_page_files(path, page_path);
+	}
+
+	pages = mip_layout(header.width, header.height);
+	file.open(page_path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "ERROR: Could not open the texture pages '" << page_path << "'.\n";
+		return false;
+	}
+	table.reset(new std::atomic<uint32_t>[pages.page_count]());
+	buffer.resize(mip_layout::page_bytes);
+	return true;
+}
+
+inline void cached_image::fetch(int l, int x, int y, unsigned char *rgb)
+{
+	const mip_layout::level &lv = pages.levels[l];
+	uint32_t page = mip_layout::page_of(lv, x, y);
+	size_t offset = mip_layout::offset_in_page(lv, x, y);
+	uint64_t key = texture_cache::make_key(id, page);
+	while (true)
+	{
+		uint32_t entry = table[page].load(std::memory_order_acquire);
+		if (entry == 0)
+			load(page);
+		else if (cache.read(entry - 1, key, offset, rgb))
+			return;
+	}
+}
+
+// read a page from the page file into the cache
+inline void cached_image::load(uint32_t page)
+{
+	std::lock_guard<std::mutex> guard(file_mutex);
+	if (table[page].load(std::memory_order_acquire) != 0)
+		return;
+	file.clear();
+	file.seekg(std::streamoff(sizeof(tile_file_header) + size_t(page) * mip_layout::page_bytes));
+	if (!file.read(reinterpret_cast<char *>(buffer.data()), std::streamsize(buffer.size())))
+	{
+		// cached as black, so the lookup can go on; the warning says why the image has holes
+		if (!read_failed)
+			std::cerr << "ERROR: Could not read from the texture pages '" << page_path << "' of '" << path
+					  << "', parts of it will render black.\n";
+		read_failed = true;
+		std::fill(buffer.begin(), buffer.end(), 0);
+	}
+	cache.store(*this, page, buffer.data());
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef TEXTURE_PROGRAM_H
+#define TEXTURE_PROGRAM_H
+
+#include "rtweekend.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <vector>
+
+// One instruction of a texture_program.
+struct texture_op
+{
+	enum kind_t : uint8_t
+	{
+		solid,		  // albedo
+		checker,	  // the even cells run the next instruction, the odd ones instruction 'other'
+		solid_checker, // a checker of two solid colors, albedo and odd_albedo, folded into one instruction
+		image,		  // leaf
+		noise,		  // leaf
+		blend,		  // mixes the next instruction with instruction 'other' by 'param'
+		call		  // any other texture, through its virtual value()
+	};
+	kind_t kind = solid;
+	uint32_t other = 0;
+	double param = 0; // checker: 1 / scale, blend: the weight of 'other'
+	color albedo, odd_albedo;
+	const texture *leaf = nullptr; // image, noise and call
+};
+
+// A texture graph compiled into a contiguous array of instructions, so that shading a point walks
+// an array instead of chasing shared_ptrs through a virtual call per node. Subtrees are laid out
+// depth first, each node's first child right after it. Solid colors are folded away: a checker or
+// blend of solids becomes a single instruction, or a solid if the result can't vary.
+class texture_program : public texture
+{
+public:
+	// A texture equivalent to 'tex': 'tex' itself if compiling gains nothing, as for a single
+	// leaf, a solid_color if the graph is constant, a texture_program otherwise.
+	static shared_ptr<texture> compile(const shared_ptr<texture> &tex)
+	{
+		if (!tex)
+			return tex;
+		auto program = make_shared<texture_program>();
+		program->emit(*tex);
+		const texture_op &root = program->ops[0];
+		if (root.kind == texture_op::solid)
+			return dynamic_cast<const solid_color *>(tex.get()) ? tex : make_shared<solid_color>(root.albedo);
+		if (root.kind == texture_op::image || root.kind == texture_op::noise || root.kind == texture_op::call)
+			return tex;
+		program->ops.shrink_to_fit();
+		program->sources = tex; // keeps the leaves alive
+		return program;
+	}
+
+	color value(double u, double v, const point3 &p) const override { return run(0, u, v, p, 0); }
+
+	color value(double u, double v, const point3 &p, double width) const override { return run(0, u, v, p, width); }
+
+	size_t size() const { return ops.size(); }
+
+private:
+	std::vector<texture_op> ops;
+	shared_ptr<texture> sources;
+
+	static bool even_cell(double inv_scale, const point3 &p)
+	{
+		auto x = int(std::floor(inv_scale * p.x()));
+		auto y = int(std::floor(inv_scale * p.y()));
+		auto z = int(std::floor(inv_scale * p.z()));
+		return (x + y + z) % 2 == 0;
+	}
+
+	color run(uint32_t i, double u, double v, const point3 &p, double width) const
+	{
+		while (true)
+		{
+			const texture_op &op = ops[i];
+			switch (op.kind)
+			{
+			case texture_op::solid:
+				return op.albedo;
+			case texture_op::checker:
+				i = even_cell(op.param, p) ? i + 1 : op.other;
+				continue;
+			case texture_op::solid_checker:
+				return even_cell(op.param, p) ? op.albedo : op.odd_albedo;
+			case texture_op::image:
+				// qualified, so the calls are direct
+				return static_cast<const image_texture *>(op.leaf)->image_texture::value(u, v, p, width);
+			case texture_op::noise:
+				return static_cast<const noise_texture *>(op.leaf)->noise_texture::value(u, v, p);
+			case texture_op::blend:
+				return (1 - op.param) * run(i + 1, u, v, p, width) + op.param * run(op.other, u, v, p, width);
+			default:
+				return op.leaf->value(u, v, p, width);
+			}
+		}
+	}
+
+	// append the instructions of 'tex' and return the index of its first one
+	uint32_t emit(const texture &tex)
+	{
+		uint32_t at = uint32_t(ops.size());
+		ops.emplace_back();
+		texture_op op;
+		if (auto solid = dynamic_cast<const solid_color *>(&tex))
+		{
+			op.albedo = solid->albedo;
+		}
+		else if (auto checker = dynamic_cast<const checker_texture *>(&tex))
+		{
+			op.kind = texture_op::checker;
+			op.param = checker->inv_scale;
+			emit(*checker->even);
+			op.other = emit(*checker->odd);
+			fold(at, op);
+		}
+		else if (auto mix = dynamic_cast<const blend_texture *>(&tex))
+		{
+			op.kind = texture_op::blend;
+			op.param = mix->amount;
+			emit(*mix->first);
+			op.other = emit(*mix->second);
+			fold(at, op);
+		}
+		else
+		{
+			op.kind = dynamic_cast<const image_texture *>(&tex)   ? texture_op::image
+					  : dynamic_cast<const noise_texture *>(&tex) ? texture_op::noise
+																  : texture_op::call;
+			op.leaf = &tex;
+		}
+		ops[at] = op;
+		return at;
+	}
+
+	// fold a checker or blend at 'at' whose children are solid, dropping their instructions
+	void fold(uint32_t at, texture_op &op)
+	{
+		const texture_op &first = ops[at + 1], &second = ops[op.other];
+		if (first.kind != texture_op::solid || second.kind != texture_op::solid)
+			return;
+		color a = first.albedo, b = second.albedo;
+		ops.resize(at + 1);
+		if (op.kind == texture_op::blend)
+		{
+			op.kind = texture_op::solid;
+			op.albedo = (1 - op.param) * a + op.param * b;
+		}
+		else if (a[0] == b[0] && a[1] == b[1] && a[2] == b[2])
+		{
+			op.kind = texture_op::solid;
+			op.albedo = a;
+		}
+		else
+		{
+			op.kind = texture_op::solid_checker;
+			op.albedo = a;
+			op.odd_albedo = b;
+		}
+	}
+};
+
+#endif
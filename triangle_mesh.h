@@ -0,0 +1,195 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "material_table.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Vertex and index arrays of a triangle mesh, in structure-of-arrays layout: one array per
+// coordinate, shared by every triangle using the vertex. Normals and texture coordinates are
+// per vertex and optional; their arrays are either empty or as long as the positions.
+struct mesh_data
+{
+	std::vector<float> x, y, z;	   // positions
+	std::vector<float> nx, ny, nz; // shading normals
+	std::vector<float> tu, tv;	   // texture coordinates
+	std::vector<uint32_t> indices; // three vertex indices per triangle, counterclockwise from the front
+
+	size_t vertex_count() const { return x.size(); }
+	size_t triangle_count() const { return indices.size() / 3; }
+	bool has_normals() const { return !nx.empty(); }
+	bool has_uvs() const { return !tu.empty(); }
+
+	point3 position(uint32_t k) const { return point3(x[k], y[k], z[k]); }
+	vec3 normal(uint32_t k) const { return vec3(nx[k], ny[k], nz[k]); }
+
+	size_t memory_bytes() const
+	{
+		return (x.capacity() + y.capacity() + z.capacity() + nx.capacity() + ny.capacity() + nz.capacity() +
+				tu.capacity() + tv.capacity()) * sizeof(float) + indices.capacity() * sizeof(uint32_t);
+	}
+};
+
+// A ray prepared for the watertight ray/triangle test of Woop, Benthin and Wald: the axis the
+// direction is largest along becomes z, and a shear maps the direction onto +z, so every
+// triangle is tested in the same 2D space. Computed once per ray, not per triangle.
+struct watertight_ray
+{
+	point3 origin;
+	int kx, ky, kz;
+	double sx, sy, sz;
+
+	explicit watertight_ray(const ray &r) : origin(r.origin())
+	{
+		const vec3 &d = r.direction();
+		kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (d[kz] < 0)
+			std::swap(kx, ky); // keep the winding, and so the sign of the edge functions
+		sx = d[kx] / d[kz];
+		sy = d[ky] / d[kz];
+		sz = 1.0 / d[kz];
+	}
+};
+
+// A triangle mesh under its own BVH whose leaves are the triangles themselves: a triangle is an
+// index triple, not an object, so a mesh of any size costs a handful of allocations.
+class triangle_mesh : public hittable
+{
+public:
+	triangle_mesh(mesh_data data, shared_ptr<material> mat, const bvh_build_options &options = bvh_build_options())
+		: mesh(std::move(data)), mat(material_table::global().add(std::move(mat)))
+	{
+		size_t count = mesh.triangle_count();
+		std::vector<aabb> boxes(count);
+		bbox = aabb::empty;
+		for (size_t k = 0; k < count; k++)
+		{
+			const uint32_t *v = &mesh.indices[3 * k];
+			boxes[k] = aabb(aabb(mesh.position(v[0]), mesh.position(v[1])), aabb(mesh.position(v[2]), mesh.position(v[2])));
+			bbox = aabb(bbox, boxes[k]);
+		}
+		tree.build(boxes, options);
+
+		// store the triangles in the order the leaves reference them, so slot k is triangle k
+		std::vector<uint32_t> ordered(mesh.indices.size());
+		for (size_t slot = 0; slot < count; slot++)
+			for (int corner = 0; corner < 3; corner++)
+				ordered[3 * slot + corner] = mesh.indices[3 * tree.indices[slot] + corner];
+		mesh.indices = std::move(ordered);
+	}
+
+	bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+	{
+		if (mesh.indices.empty())
+			return false;
+
+		watertight_ray wr(r);
+		uint32_t nearest = 0;
+		double nearest_t = 0, b1 = 0, b2 = 0;
+		bool hit_anything = tree.traverse(r, ray_t, [&](uint32_t triangle, interval &t)
+										  {
+			const uint32_t *v = &mesh.indices[3 * triangle];
+			double tt, u, w;
+			if (!intersect(wr, t, mesh.position(v[0]), mesh.position(v[1]), mesh.position(v[2]), tt, u, w))
+				return false;
+			t.max = nearest_t = tt;
+			nearest = triangle;
+			b1 = u;
+			b2 = w;
+			return true; });
+		if (!hit_anything)
+			return false;
+
+		// shade only the nearest hit
+		const uint32_t *v = &mesh.indices[3 * nearest];
+		point3 p0 = mesh.position(v[0]), p1 = mesh.position(v[1]), p2 = mesh.position(v[2]);
+		double b0 = 1 - b1 - b2;
+		rec.t = nearest_t;
+		rec.p = r.at(nearest_t);
+		rec.mat = mat;
+		rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+		if (mesh.has_normals())
+		{
+			vec3 n = unit_vector(b0 * mesh.normal(v[0]) + b1 * mesh.normal(v[1]) + b2 * mesh.normal(v[2]));
+			rec.normal = rec.front_face ? n : -n;
+		}
+		if (mesh.has_uvs())
+		{
+			rec.u = b0 * mesh.tu[v[0]] + b1 * mesh.tu[v[1]] + b2 * mesh.tu[v[2]];
+			rec.v = b0 * mesh.tv[v[0]] + b1 * mesh.tv[v[1]] + b2 * mesh.tv[v[2]];
+			rec.uv_scale = uv_scale(p1 - p0, p2 - p0, mesh.tu[v[1]] - mesh.tu[v[0]], mesh.tv[v[1]] - mesh.tv[v[0]],
+									mesh.tu[v[2]] - mesh.tu[v[0]], mesh.tv[v[2]] - mesh.tv[v[0]]);
+		}
+		else
+		{
+			rec.u = b1;
+			rec.v = b2;
+			rec.uv_scale = uv_scale(p1 - p0, p2 - p0, 1, 0, 0, 1);
+		}
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// Watertight ray/triangle test: no ray slips between two triangles sharing an edge, and none
+	// hits both. Edge functions are evaluated in the sheared space of wr, where a shared edge
+	// gives the same value with opposite signs to its two triangles, and a ray crossing an edge
+	// or vertex exactly counts as inside. On a hit inside ray_t, t is its distance and b1, b2 the
+	// barycentric weights of p1 and p2, as Moller-Trumbore would return them.
+	static bool intersect(const watertight_ray &wr, interval ray_t, const point3 &p0, const point3 &p1,
+						  const point3 &p2, double &t, double &b1, double &b2)
+	{
+		vec3 a = p0 - wr.origin, b = p1 - wr.origin, c = p2 - wr.origin;
+		double ax = a[wr.kx] - wr.sx * a[wr.kz], ay = a[wr.ky] - wr.sy * a[wr.kz];
+		double bx = b[wr.kx] - wr.sx * b[wr.kz], by = b[wr.ky] - wr.sy * b[wr.kz];
+		double cx = c[wr.kx] - wr.sx * c[wr.kz], cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+		double e0 = cx * by - cy * bx; // weight of p0
+		double e1 = ax * cy - ay * cx; // weight of p1
+		double e2 = bx * ay - by * ax; // weight of p2
+		if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+			return false;
+		double det = e0 + e1 + e2;
+		if (det == 0)
+			return false;
+
+		double depth = e0 * wr.sz * a[wr.kz] + e1 * wr.sz * b[wr.kz] + e2 * wr.sz * c[wr.kz];
+		double inv_det = 1.0 / det;
+		t = depth * inv_det;
+		if (!ray_t.surrounds(t))
+			return false;
+		b1 = e1 * inv_det;
+		b2 = e2 * inv_det;
+		return true;
+	}
+
+	// change of the texture coordinates per unit of length over a triangle with edges e1 and e2
+	// from its first corner, along which they change by (du1, dv1) and (du2, dv2): the square
+	// root of the ratio of its areas in texture space and in space
+	static double uv_scale(const vec3 &e1, const vec3 &e2, double du1, double dv1, double du2, double dv2)
+	{
+		double area = cross(e1, e2).length();
+		return area > 0 ? sqrt(fabs(du1 * dv2 - du2 * dv1) / area) : 0;
+	}
+
+	const mesh_data &data() const { return mesh; }
+	const linear_bvh &bvh() const { return tree; }
+
+	// bytes held by the vertex, index and BVH arrays
+	size_t memory_bytes() const { return mesh.memory_bytes() + tree.memory_bytes(); }
+
+private:
+	mesh_data mesh;
+	const material *mat; // owned by material_table
+	linear_bvh tree;
+	aabb bbox;
+};
+
+#endif